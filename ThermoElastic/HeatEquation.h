@@ -17,6 +17,7 @@
 #include "IntegrandBase.h"
 #include "EqualOrderOperators.h"
 #include "LinIsotropic.h"
+#include "PointCache.h"
 #include "BDF.h"
 
 
@@ -29,16 +30,33 @@ class HeatEquation : public IntegrandBase
 {
 public:
   typedef LinIsotropic MaterialType; //!< Material used in this integrand
+  typedef std::vector<Material*> MaterialVec; //!< Materials of all elements
   using WeakOps = EqualOrderOperators::Weak; //!< Convenience rename
 
+  //! \brief Enum defining the treatment of temperature-dependent materials.
+  enum Linearization {
+    LINEAR, //!< Material evaluated at previous time step, single solve
+    PICARD, //!< Material evaluated at current iterate
+    NEWTON  //!< Consistent tangent including material derivatives
+  };
+
   //! \brief Class representing the weak Dirichlet integrand.
   class WeakDirichlet : public IntegrandBase
   {
   public:
     //! \brief Default constructor.
     //! \param[in] n Number of spatial dimensions
-    WeakDirichlet(unsigned short int n) :
-      flux(nullptr), mat(nullptr), envT(273.5), envCond(1.0) { nsd=n; }
+    //! \param[in] order Temporal order (1,2)
+    //! \details The time levels of the temperature are the same as for the
+    //! heat equation integrand, such that the material can be evaluated at
+    //! the previous time step.
+    WeakDirichlet(unsigned short int n, int order = 1) :
+      flux(nullptr), mat(nullptr), elmMat(nullptr), envT(273.5), envCond(1.0),
+      dirichletLHS(true), newton(false), matLevel(0)
+    {
+      nsd = n;
+      primsol.resize(order+1);
+    }
 
     //! \brief Empty destructor.
     virtual ~WeakDirichlet() {}
@@ -58,18 +76,33 @@ public:
 
     //! \brief Defines the material properties.
     void setMaterial(Material* material) { mat = material; }
+    //! \brief Defines the material properties of each element.
+    void setElementMaterials(const MaterialVec* m) { elmMat = m; }
     //! \brief Defines the flux function.
     void setFlux(RealFunc* f) { flux = f; }
     //! \brief Sets temperature of environment.
     void setEnvTemperature(double T) { envT = T; }
     //! \brief Sets conductivity of environment.
     void setEnvConductivity(double alpha) { envCond = alpha; }
+    //! \brief Toggles evaluation of element matrices in RHS_ONLY mode.
+    void setDirichletLHS(bool lhs) { dirichletLHS = lhs; }
+    //! \brief Sets the time level of the temperature to evaluate material at.
+    //! \details Level 0 is the current iterate, level 1 the previous step.
+    void setMaterialLevel(size_t level) { matLevel = level; }
+    //! \brief Toggles the consistent tangent of the conductivity term.
+    //! \details Only meaningful with the material evaluated at the current
+    //! iterate, i.e., material level 0.
+    void setNewtonTangent(bool tangent) { newton = tangent; }
 
   private:
-    RealFunc* flux; //!< Flux function
-    Material* mat;  //!< Material parameters
-    double envT;    //!< Temperature of environment
-    double envCond; //!< Conductivity of environment
+    RealFunc* flux;    //!< Flux function
+    Material* mat;     //!< Material parameters
+    const MaterialVec* elmMat; //!< Material parameters of each element
+    double envT;       //!< Temperature of environment
+    double envCond;    //!< Conductivity of environment
+    bool dirichletLHS; //!< If \e true, evaluate matrices in RHS_ONLY mode
+    bool newton;       //!< If \e true, add the conductivity derivative
+    size_t matLevel;   //!< Time level of temperature for material evaluation
   };
 
   //! \brief The default constructor initializes all pointers to zero.
@@ -80,6 +113,12 @@ public:
   //! \brief Empty destructor.
   virtual ~HeatEquation() {}
 
+  //! \brief Returns a local integral contribution object for given element.
+  //! \param[in] nen Number of nodes on element
+  //! \param[in] neumann Whether or not we are assembling Neumann BCs
+  virtual LocalIntegral* getLocalIntegral(size_t nen, size_t,
+                                          bool neumann) const;
+
   //! \brief Evaluates the integrand at an interior point.
   //! \param elmInt The local integral object to receive the contributions
   //! \param[in] fe Finite element data of current integration point
@@ -97,19 +136,114 @@ public:
 
   //! \brief Advance time stepping scheme.
   void advanceStep() { bdf.advanceStep(); }
+  //! \brief Returns the BDF helper of the time stepping scheme.
+  const TimeIntegration::BDF& getBDF() const { return bdf; }
+
+  //! \brief Defines BDF2 coefficients for a variable time step size.
+  //! \param[in] ratio Ratio between current and previous step size.
+  //! If zero or negative, BDF1 coefficients are used
+  void setVariableBDF(double ratio);
+  //! \brief Reverts to the constant step size coefficients of the BDF helper.
+  void clearVariableBDF() { coeffs.clear(); }
+  //! \brief Returns a BDF coefficient of current time step.
+  //! \param[in] t Time level index (0 = current step)
+  double getBDFCoeff(int t) const;
+  //! \brief Returns the BDF order of current time step.
+  int getBDFOrder() const;
 
   //! \brief Defines the material properties.
   void setMaterial(Material* material) { mat = material; }
 
+  //! \brief Defines the treatment of temperature-dependent materials.
+  //! \details With Newton linearization, the tangent includes the
+  //! derivatives of the conductivity and heat capacity in the interior terms.
+  //! The conductivity scaling of the Neumann flux is lagged, since the
+  //! Neumann terms are assembled into the right-hand-side only.
+  //! The Robin terms are handled by WeakDirichlet::setNewtonTangent().
+  void setLinearization(Linearization l) { linearization = l; }
+  //! \brief Returns the treatment of temperature-dependent materials.
+  Linearization getLinearization() const { return linearization; }
+
+  //! \brief Toggles evaluation of element matrices in RHS_ONLY mode.
+  //! \details The element matrices are needed in RHS_ONLY mode only when
+  //! the model has inhomogeneous Dirichlet conditions.
+  void setDirichletLHS(bool lhs) { dirichletLHS = lhs; }
+
+  //! \brief Toggles the fused element matrix kernel.
+  //! \details If enabled, the Laplacian and mass matrices are added to the
+  //! element matrix in a single sweep, see LaplaceMass().
+  void setFusedKernel(bool fused) { fusedKernel = fused; }
+
+  //! \brief Adds Laplacian and mass matrices of an integration point.
+  //! \param A The element matrix to add the contributions to
+  //! \param[in] fe Finite element data of current integration point
+  //! \param[in] kappa Coefficient of the Laplacian
+  //! \param[in] mass Coefficient of the mass matrix
+  static void LaplaceMass(Matrix& A, const FiniteElement& fe,
+                          double kappa, double mass);
+
   //! \brief Defines the source term
-  void setSource(RealFunc* src) { sourceTerm = src; }
+  //! \param[in] src The source function
+  //! \param[in] timeDep If \e false, the source values are cached at the
+  //! integration points when the point cache is allocated
+  void setSource(RealFunc* src, bool timeDep = true)
+  {
+    sourceTerm = src;
+    staticSource = !timeDep;
+  }
+  //! \brief Returns the source function.
+  RealFunc* getSourceTerm() const { return sourceTerm; }
+  //! \brief Returns \e true if the source term is time-independent.
+  bool hasStaticSource() const { return sourceTerm && staticSource; }
+
+  //! \brief Allocates the cache of the time-independent source term.
+  //! \param[in] nPoints Number of interior integration points in the model
+  //! \param[in] budget Maximum memory usage in megabytes
+  void initPointCache(size_t nPoints, double budget)
+  {
+    geoCache.init(nPoints,budget);
+  }
+  //! \brief Returns the cache of the time-independent source term.
+  const PointCache& getPointCache() const { return geoCache; }
 
   //! \brief Evaluates the source term (if any) at a specified point.
   //! \param[in] X Cartesian coordinate of current integration point
   double getSource(const Vec3& X) const;
+  //! \brief Evaluates the source term (if any) at an integration point.
+  //! \param[in] fe Finite element data of current integration point
+  //! \param[in] X Cartesian coordinate of current integration point
+  //! \details A time-independent source is taken from the point cache,
+  //! if allocated.
+  double getSource(const FiniteElement& fe, const Vec3& X) const;
+
+  //! \brief Checks whether the material properties depend on temperature.
+  //! \param[in] mat The material to check
+  //! \details The Material interface has no such query, so the thermal
+  //! conductivity and the heat capacity are sampled over a range of
+  //! temperatures.
+  static bool isTempDependent(const Material* mat);
 
   //! \brief Obtain the current material.
   const Material* getMaterial() const { return mat; }
+  //! \brief Obtain the material of an element.
+  //! \param[in] iel Global element number (1-based)
+  const Material* getMaterial(int iel) const
+  {
+    return resolveMaterial(elmMat,iel,mat);
+  }
+
+  //! \brief Looks up the material of an element.
+  //! \param[in] elmMat Material parameters of each element
+  //! \param[in] iel Global element number (1-based)
+  //! \param[in] def Material to use if the element has no material
+  static const Material* resolveMaterial(const MaterialVec* elmMat, int iel,
+                                         const Material* def)
+  {
+    if (!elmMat || iel < 1 || iel > (int)elmMat->size() || !(*elmMat)[iel-1])
+      return def;
+
+    return (*elmMat)[iel-1];
+  }
 
   //! \brief Defines the flux function.
   void setFlux(RealFunc* f) { flux = f; }
@@ -145,10 +279,17 @@ public:
 
 private:
   TimeIntegration::BDF bdf; //!< BDF helper class
+  std::vector<double> coeffs; //!< BDF coefficients for variable step sizes
   Material* mat;            //!< Material parameters
+  const MaterialVec* elmMat; //!< Material parameters of each element
   RealFunc* flux;           //!< Pointer to the heat flux field
   const RealFunc* init;     //!< Initial temperature function
   RealFunc* sourceTerm;     //!< Pointer to source term
+  bool staticSource;        //!< If \e true, the source is time-independent
+  bool dirichletLHS;        //!< If \e true, evaluate matrices in RHS_ONLY mode
+  bool fusedKernel;         //!< If \e true, use the fused element matrix kernel
+  Linearization linearization; //!< Treatment of temperature dependencies
+  mutable PointCache geoCache; //!< Source term at integration points
 };
 
 
@@ -18,6 +18,7 @@
 #include "FiniteElement.h"
 #include "IntegrandBase.h"
 #include "Vec3Oper.h"
+#include <algorithm>
 
 
 /*!
@@ -44,27 +45,50 @@ public:
                        const TimeDomain& time,
                        const Vec3& X, const Vec3& normal) const
   {
-    HE& problem = static_cast<HE&>(myProblem);
     ElmNorm& elmNorm = static_cast<ElmNorm&>(elmInt);
+    elmNorm[0] += evalFlux(static_cast<HE&>(myProblem),fe,normal,
+                           elmNorm.vec[0]);
 
-    const Material* mat = problem.getMaterial();
+    return true;
+  }
 
-    double theta = fe.N.dot(elmNorm.vec[0]);
-    double kappa=mat?mat->getThermalConductivity(theta):1.0;
+  //! \brief Returns the number of force components.
+  virtual size_t getNoComps() const { return 1; }
 
-    // Temperature gradient in integration point
-    Vec3 gradT;
-    for (size_t i = 1;i <= fe.N.size();i++)
-      for (size_t l = 1;l <= problem.getNoSpaceDim();l++)
-        gradT[l-1] += fe.dNdX(i,l)*elmNorm.vec[0](i);
+  //! \brief Evaluates the heat flux through the boundary at a point.
+  //! \param[in] problem The heat equation problem
+  //! \param[in] fe Finite element data of current integration point
+  //! \param[in] normal Boundary normal vector at current integration point
+  //! \param[in] eV Element temperature vector
+  static double evalFlux(const HE& problem, const FiniteElement& fe,
+                         const Vec3& normal, const Vector& eV)
+  {
+    const Material* mat = problem.getMaterial(fe.iel);
 
-    elmNorm[0] += kappa*gradT*normal*fe.detJxW;
+    double theta = fe.N.dot(eV);
+    double kappa=mat?mat->getThermalConductivity(theta):1.0;
 
-    return true;
+    return kappa*(evalGradient(fe,eV)*normal)*fe.detJxW;
   }
 
-  //! \brief Returns the number of force components.
-  virtual size_t getNoComps() const { return 1; }
+  //! \brief Evaluates the temperature gradient at a point.
+  //! \param[in] fe Finite element data of current integration point
+  //! \param[in] eV Element temperature vector
+  //! \details The gradient is computed as dNdX^T * eV, by one dot product
+  //! per column of the (column-major) basis function gradient matrix.
+  static Vec3 evalGradient(const FiniteElement& fe, const Vector& eV)
+  {
+    Vec3 gradT;
+    const size_t nen = std::min(fe.dNdX.rows(),eV.size());
+    for (size_t l = 0; l < fe.dNdX.cols() && l < 3; l++)
+    {
+      const double* dNdX = fe.dNdX.ptr(l);
+      for (size_t i = 0; i < nen; i++)
+        gradT[l] += dNdX[i]*eV[i];
+    }
+
+    return gradT;
+  }
 };
 
 
@@ -91,16 +115,8 @@ public:
   virtual bool evalInt(LocalIntegral& elmInt, const FiniteElement& fe,
                        const TimeDomain& time, const Vec3& X) const
   {
-    HE& problem = static_cast<HE&>(myProblem);
     ElmNorm& elmNorm = static_cast<ElmNorm&>(elmInt);
-
-    const Material* mat = problem.getMaterial();
-
-    double theta = fe.N.dot(elmNorm.vec[0]);
-    double theta0 = problem.initialTemperature(X);
-    double rhocp = mat?mat->getMassDensity(X)*mat->getHeatCapacity(theta):1.0;
-
-    elmNorm[0] = rhocp*(theta-theta0)*fe.detJxW;
+    elmNorm[0] = evalEnergy(static_cast<HE&>(myProblem),fe,X,elmNorm.vec[0]);
 
     return true;
   }
@@ -146,6 +162,114 @@ public:
 
   //! \brief This is a volume integrand
   virtual bool hasInteriorTerms() const { return true; }
+
+  //! \brief Evaluates the stored energy density at a point.
+  //! \param[in] problem The heat equation problem
+  //! \param[in] fe Finite element data of current integration point
+  //! \param[in] X Cartesian coordinates of current integration point
+  //! \param[in] eV Element temperature vector
+  static double evalEnergy(const HE& problem, const FiniteElement& fe,
+                           const Vec3& X, const Vector& eV)
+  {
+    const Material* mat = problem.getMaterial(fe.iel);
+
+    double theta = fe.N.dot(eV);
+    double theta0 = problem.initialTemperature(X);
+    double rhocp = mat?mat->getMassDensity(X)*mat->getHeatCapacity(theta):1.0;
+
+    return rhocp*(theta-theta0)*fe.detJxW;
+  }
+};
+
+
+/*!
+  \brief Class representing the integrand for computing several boundary heat
+  fluxes and stored energies in a single pass over the model.
+  \details Each monitored set is assigned a component of the integral.
+  The components receiving the contributions are selected with setActive()
+  before each patch or patch boundary is integrated, such that each patch
+  and patch boundary is traversed only once, even if it belongs to several
+  monitored sets.
+*/
+template<class HE> class HeatEquationIntegrals : public ForceBase
+{
+public:
+  //! \brief The constructor initializes the number of monitored sets.
+  //! \param[in] p The heat equation problem to evaluate integrals for
+  //! \param[in] n Number of monitored sets
+  HeatEquationIntegrals(HE& p, size_t n) : ForceBase(p), nSets(n) {}
+
+  //! \brief Empty destructor.
+  virtual ~HeatEquationIntegrals() {}
+
+  //! \brief Selects the sets receiving the contributions.
+  //! \param[in] sets Zero-based indices of the sets
+  void setActive(const std::vector<size_t>& sets) { active = sets; }
+
+  //! \brief Evaluates the heat flux at a boundary point.
+  //! \param elmInt The local integral object to receive the contributions
+  //! \param[in] fe Finite element data of current integration point
+  //! \param[in] normal Boundary normal vector at current integration point
+  virtual bool evalBou(LocalIntegral& elmInt, const FiniteElement& fe,
+                       const TimeDomain&, const Vec3&,
+                       const Vec3& normal) const
+  {
+    ElmNorm& elmNorm = static_cast<ElmNorm&>(elmInt);
+    const HE& problem = static_cast<const HE&>(myProblem);
+    double flux = HeatEquationFlux<HE>::evalFlux(problem,fe,normal,
+                                                 elmNorm.vec[0]);
+    for (size_t k : active)
+      elmNorm[k] += flux;
+    return true;
+  }
+
+  //! \brief Evaluates the stored energy at an interior point.
+  //! \param elmInt The local integral object to receive the contributions
+  //! \param[in] fe Finite element data of current integration point
+  //! \param[in] X Cartesian coordinates of current integration point
+  virtual bool evalInt(LocalIntegral& elmInt, const FiniteElement& fe,
+                       const TimeDomain&, const Vec3& X) const
+  {
+    ElmNorm& elmNorm = static_cast<ElmNorm&>(elmInt);
+    const HE& problem = static_cast<const HE&>(myProblem);
+    double energy = HeatEquationStoredEnergy<HE>::evalEnergy(problem,fe,X,
+                                                             elmNorm.vec[0]);
+    for (size_t k : active)
+      elmNorm[k] = energy;
+    return true;
+  }
+
+  //! \brief Returns the number of integral components.
+  virtual size_t getNoComps() const { return nSets; }
+
+  using ForceBase::getLocalIntegral;
+  //! \brief Returns a local integral contribution object for the given element.
+  //! \param[in] nen1 Number of nodes on element for basis 1
+  //! \param[in] iEl Global element number (1-based)
+  //! \param[in] neumann Whether or not we are assembling Neumann BCs
+  virtual LocalIntegral* getLocalIntegral(size_t nen1, size_t, size_t iEl,
+                                          bool neumann = false) const
+  {
+    return this->getLocalIntegral(nen1,iEl,neumann);
+  }
+
+  using ForceBase::initElement;
+  //! \brief Initializes current element for numerical integration.
+  //! \param[in] MNPC Matrix of nodal point correspondance for current element
+  //! \param elmInt Local integral for element
+  virtual bool initElement(const std::vector<int>& MNPC,
+                           const FiniteElement&, const Vec3&, size_t,
+                           LocalIntegral& elmInt)
+  { return myProblem.initElement(MNPC, elmInt); }
+
+  //! \brief This integrand has both volume and boundary terms.
+  virtual bool hasInteriorTerms() const { return true; }
+  //! \brief This integrand has both volume and boundary terms.
+  virtual bool hasBoundaryTerms() const { return true; }
+
+private:
+  size_t nSets;  //!< Number of monitored sets
+  std::vector<size_t> active; //!< Indices of the sets receiving contributions
 };
 
 #endif
@@ -0,0 +1,142 @@
+// $Id$
+//==============================================================================
+//!
+//! \file PointCache.h
+//!
+//! \date Oct 15 2026
+//!
+//! \author agent
+//!
+//! \brief Cache of time-independent quantities at integration points.
+//!
+//==============================================================================
+
+#ifndef _POINT_CACHE_H
+#define _POINT_CACHE_H
+
+#include "Vec3.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+
+/*!
+  \brief Class caching time-independent values at the integration points.
+  \details The values are stored by the global integration point counter
+  FiniteElement::iGP, together with the coordinates of the point. A lookup is
+  only a hit if the coordinates match, so the cache stays consistent even if
+  the same point counter is used with another quadrature rule.
+
+  A lookup costs more than returning a constant material property, so only
+  values that are expensive to evaluate are worth caching, such as a
+  time-independent source term given by a function expression.
+
+  The storage is allocated once in init(), and each point is only written
+  by the thread integrating its element. The cache can therefore be used
+  from within threaded assembly loops without locking.
+*/
+
+class PointCache
+{
+public:
+  //! \brief Default constructor.
+  //! \param[in] n Number of values to cache in each point
+  explicit PointCache(size_t n = 1) : nVal(n), nReq(0) {}
+
+  //! \brief Allocates the cache.
+  //! \param[in] nPoints Number of integration points in the model
+  //! \param[in] budget Maximum memory usage in megabytes
+  //! \details If the budget is exceeded, only the first points are cached.
+  void init(size_t nPoints, double budget)
+  {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    size_t perPoint = (3+nVal)*sizeof(double);
+    size_t nPts = std::min(nPoints,(size_t)(budget*1048576.0/perPoint));
+    coords.assign(3*nPts,nan);
+    values.assign(nVal*nPts,nan);
+    nReq = nPoints;
+  }
+
+  //! \brief Clears the cache.
+  void clear() { coords.clear(); values.clear(); nReq = 0; }
+
+  //! \brief Returns \e true if the cache is allocated.
+  bool empty() const { return coords.empty(); }
+
+  //! \brief Looks up a value in the cache.
+  //! \param[in] iGP Global integration point counter
+  //! \param[in] X Cartesian coordinates of the point
+  //! \param[in] k Zero-based index of the value to look up
+  //! \param[out] val The cached value
+  //! \return \e true if the value was found, otherwise \e false
+  bool get(size_t iGP, const Vec3& X, size_t k, double& val) const
+  {
+    if (3*iGP >= coords.size() || !this->matches(iGP,X))
+      return false;
+
+    double v = values[nVal*iGP+k];
+    if (std::isnan(v))
+      return false;
+
+    val = v;
+    return true;
+  }
+
+  //! \brief Stores a value in the cache.
+  //! \param[in] iGP Global integration point counter
+  //! \param[in] X Cartesian coordinates of the point
+  //! \param[in] k Zero-based index of the value to store
+  //! \param[in] val The value to store
+  void set(size_t iGP, const Vec3& X, size_t k, double val)
+  {
+    if (3*iGP >= coords.size())
+      return;
+
+    if (!this->matches(iGP,X))
+    {
+      // A new point, invalidate all values stored for the previous one
+      for (size_t i = 0; i < 3; i++)
+        coords[3*iGP+i] = X[i];
+      std::fill(values.begin()+nVal*iGP,values.begin()+nVal*(iGP+1),
+                std::numeric_limits<double>::quiet_NaN());
+    }
+    values[nVal*iGP+k] = val;
+  }
+
+  //! \brief Returns the number of points requested in init().
+  size_t getNoRequested() const { return nReq; }
+  //! \brief Returns the number of points that fit in the cache.
+  size_t getCapacity() const { return coords.size()/3; }
+  //! \brief Returns the number of points currently stored in the cache.
+  size_t getNoCached() const
+  {
+    size_t nPts = 0;
+    for (size_t i = 0; i < coords.size(); i += 3)
+      if (!std::isnan(coords[i])) nPts++;
+    return nPts;
+  }
+  //! \brief Returns the allocated memory in megabytes.
+  double getMemory() const
+  {
+    return (coords.size()+values.size())*sizeof(double)/1048576.0;
+  }
+
+private:
+  //! \brief Checks if the cached point \a iGP has the coordinates \a X.
+  bool matches(size_t iGP, const Vec3& X) const
+  {
+    const double* x = coords.data() + 3*iGP;
+    double tol = 1.0e-12*(1.0 + X.length());
+    return fabs(x[0]-X.x) <= tol && fabs(x[1]-X.y) <= tol &&
+           fabs(x[2]-X.z) <= tol;
+  }
+
+  size_t nVal; //!< Number of values in each point
+  size_t nReq; //!< Number of points requested
+
+  std::vector<double> coords; //!< Coordinates of the cached points
+  std::vector<double> values; //!< Cached values
+};
+
+#endif
@@ -0,0 +1,161 @@
+// $Id$
+//==============================================================================
+//!
+//! \file PreconditionerPolicy.h
+//!
+//! \date Oct 15 2026
+//!
+//! \author agent
+//!
+//! \brief Policy for reuse of preconditioners of iterative equation solvers.
+//!
+//==============================================================================
+
+#ifndef _PRECONDITIONER_POLICY_H
+#define _PRECONDITIONER_POLICY_H
+
+#include "Utilities.h"
+#include "tinyxml.h"
+#include <string>
+
+
+/*!
+  \brief Class deciding when to rebuild the preconditioner of a linear solver.
+  \details The preconditioner is either rebuilt whenever the system matrix
+  changes (NEVER reuse), every \a stride solve (STRIDE), or when the solve
+  time has grown by more than \a growth percent compared to the first solve
+  with the current preconditioner (GROWTH). The solve time is used as a proxy
+  for the iteration count, which is not available through the generic
+  equation solver interface. To avoid rebuilding on every fluctuation of the
+  solve time, the GROWTH policy keeps a preconditioner for at least
+  \a minSteps solves.
+
+  A reused preconditioner is requested by passing \a newLHS = \e false to
+  SIMbase::solveSystem() with an updated system matrix. This relies on the
+  IFEM solver backends separating the preconditioner setup from the operator:
+  PETScMatrix::solve() calls KSPSetOperators() with the current matrix in
+  every solve, and KSPSetReusePreconditioner(ksp,!newLHS), so the Krylov
+  iterations use the new matrix values with the old preconditioner.
+  ISTLMatrix::solve() only sets up the preconditioner when \a newLHS is
+  \e true, while its matrix adapter refers to the matrix holding the new
+  values.
+*/
+
+class PreconditionerPolicy
+{
+public:
+  //! \brief Enum defining the available reuse policies.
+  enum Mode { NEVER, STRIDE, GROWTH };
+
+  //! \brief Default constructor.
+  PreconditionerPolicy() : mode(NEVER), stride(1), growth(50.0),
+    minSteps(3), nSince(0), refTime(0.0), lastTime(0.0), nRebuild(0), nReuse(0),
+    rebuildTime(0.0), reuseTime(0.0), lastRebuilt(true) {}
+
+  //! \brief Parses the policy from an XML element.
+  //! \param[in] elem The XML element to parse
+  void parse(const TiXmlElement* elem)
+  {
+    std::string type("never");
+    utl::getAttribute(elem,"policy",type,true);
+    utl::getAttribute(elem,"stride",stride);
+    utl::getAttribute(elem,"growth",growth);
+    utl::getAttribute(elem,"minsteps",minSteps);
+    if (type == "stride")
+      mode = STRIDE;
+    else if (type == "growth")
+      mode = GROWTH;
+    else
+      mode = NEVER;
+  }
+
+  //! \brief Defines the reuse policy.
+  //! \param[in] m The policy to use
+  //! \param[in] n Rebuild every \a n solve (STRIDE)
+  //! \param[in] pct Allowed solve time growth in percent (GROWTH)
+  //! \param[in] nMin Minimum number of solves between rebuilds (GROWTH)
+  void setPolicy(Mode m, int n = 1, double pct = 50.0, int nMin = 3)
+  {
+    mode = m;
+    stride = n;
+    growth = pct;
+    minSteps = nMin;
+  }
+
+  //! \brief Returns the name of the reuse policy.
+  const char* getName() const
+  {
+    return mode == STRIDE ? "stride" : (mode == GROWTH ? "growth" : "never");
+  }
+
+  //! \brief Returns \e true if a preconditioner may be reused at all.
+  bool isActive() const { return mode != NEVER; }
+
+  //! \brief Decides whether the preconditioner is to be rebuilt.
+  //! \param[in] newMatrix If \e true, the system matrix has changed
+  bool rebuild(bool newMatrix) const
+  {
+    if (!newMatrix && nRebuild > 0)
+      return false;
+    else if (nRebuild == 0 || mode == NEVER)
+      return true;
+    else if (mode == STRIDE)
+      return nSince >= stride;
+
+    else if (nSince < minSteps)
+      return false;
+
+    return refTime > 0.0 && lastTime > refTime*(1.0+0.01*growth);
+  }
+
+  //! \brief Registers a linear solve.
+  //! \param[in] rebuilt If \e true, the preconditioner was rebuilt
+  //! \param[in] time Wall time of the solve, including any setup
+  void update(bool rebuilt, double time)
+  {
+    lastRebuilt = rebuilt;
+    if (rebuilt) {
+      ++nRebuild;
+      rebuildTime += time;
+      nSince = 1;
+      refTime = lastTime = 0.0;
+    }
+    else {
+      ++nReuse;
+      reuseTime += time;
+      ++nSince;
+      if (refTime <= 0.0)
+        refTime = time; // the first solve without the setup cost
+      lastTime = time;
+    }
+  }
+
+  //! \brief Returns \e true if the last solve rebuilt the preconditioner.
+  bool wasRebuilt() const { return lastRebuilt; }
+  //! \brief Returns the number of solves with preconditioner setup.
+  int getNoRebuilds() const { return nRebuild; }
+  //! \brief Returns the number of solves reusing the preconditioner.
+  int getNoReuses() const { return nReuse; }
+  //! \brief Returns the total wall time of solves with preconditioner setup.
+  double getRebuildTime() const { return rebuildTime; }
+  //! \brief Returns the total wall time of solves reusing the preconditioner.
+  double getReuseTime() const { return reuseTime; }
+
+private:
+  Mode   mode;     //!< The reuse policy
+  int    stride;   //!< Number of solves between each rebuild (STRIDE)
+  double growth;   //!< Allowed solve time growth in percent (GROWTH)
+  int    minSteps; //!< Minimum number of solves between rebuilds (GROWTH)
+
+  int    nSince;   //!< Number of solves with current preconditioner
+  double refTime;  //!< First solve time with current preconditioner
+  double lastTime; //!< Last solve time with current preconditioner
+
+  int    nRebuild;    //!< Number of solves with preconditioner setup
+  int    nReuse;      //!< Number of solves reusing the preconditioner
+  double rebuildTime; //!< Total time of solves with preconditioner setup
+  double reuseTime;   //!< Total time of solves reusing the preconditioner
+  bool   lastRebuilt; //!< If \e true, the last solve rebuilt it
+};
+
+#endif
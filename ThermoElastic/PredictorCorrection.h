@@ -0,0 +1,104 @@
+// $Id$
+//==============================================================================
+//!
+//! \file PredictorCorrection.h
+//!
+//! \date Oct 15 2026
+//!
+//! \author agent
+//!
+//! \brief Solution of an assembled linear system for a predictor correction.
+//!
+//==============================================================================
+
+#ifndef _PREDICTOR_CORRECTION_H
+#define _PREDICTOR_CORRECTION_H
+
+#include "SIMbase.h"
+#include "SAM.h"
+#include "SystemMatrix.h"
+#include "MatVec.h"
+#include <memory>
+
+
+/*!
+  \brief Class solving an assembled linear system for a predictor correction.
+  \details The generic equation solver interface does not pass an initial
+  guess to iterative solvers. Instead, the assembled right-hand-side b is
+  replaced by b - A*x0, with x0 a predicted solution, such that the system is
+  solved for the correction of the predictor. The correction is added to
+  the predictor afterwards. An iterative solver then effectively starts from
+  the predictor, and needs fewer iterations the better the prediction is.
+
+  The assembled system matrix must be intact when apply() is invoked,
+  i.e., it must not have been factorized by a direct equation solver.
+  The model is assumed to be assembled with the absolute Dirichlet values,
+  which are restored when expanding the solution in update().
+*/
+
+class PredictorCorrection
+{
+public:
+  //! \brief Replaces the right-hand-side by b - A*x0.
+  //! \param[in] sim The simulator holding the assembled linear system
+  //! \param[in] x0 Predicted solution, in nodal DOF order
+  bool apply(const SIMbase& sim, const Vector& x0)
+  {
+    SystemMatrix* A = sim.getLHSmatrix();
+    SystemVector* b = sim.getRHSvector();
+    const SAM* sam = sim.getSAM();
+    if (!A || !b || !sam)
+      return false;
+
+    // Map the predictor to equation order, constrained DOFs are skipped
+    pred.reset(b->copy());
+    pred->init();
+    Real* x = pred->getPtr();
+    for (int inod = 1; inod <= sam->getNoNodes(); inod++)
+    {
+      std::pair<int,int> dofs = sam->getNodeDOFs(inod);
+      for (int idof = dofs.first; idof <= dofs.second; idof++)
+      {
+        int ieq = sam->getEquation(inod,1+idof-dofs.first);
+        if (ieq > 0 && idof <= (int)x0.size())
+          x[ieq-1] = x0(idof);
+      }
+    }
+    pred->restoreValues();
+
+    std::unique_ptr<SystemVector> Ax0(b->copy());
+    if (!A->multiply(*pred,*Ax0))
+    {
+      pred.reset();
+      return false;
+    }
+
+    b->add(*Ax0,-1.0);
+    return true;
+  }
+
+  //! \brief Adds the predictor to the solved correction.
+  //! \param[in] sim The simulator holding the solved linear system
+  //! \param[out] sol Solution vector, in nodal DOF order
+  //! \details The solution of the equation solver is assumed to be in the
+  //! right-hand-side vector, as left by SIMbase::solveSystem().
+  bool update(const SIMbase& sim, Vector& sol)
+  {
+    SystemVector* b = sim.getRHSvector();
+    const SAM* sam = sim.getSAM();
+    if (!pred || !b || !sam)
+      return false;
+
+    b->add(*pred);
+    pred.reset();
+    return sam->expandSolution(*b,sol);
+  }
+
+  //! \brief Returns \e true if a predictor has been applied.
+  bool isActive() const { return pred.get() != nullptr; }
+
+private:
+  std::unique_ptr<SystemVector> pred; //!< Predictor in equation order
+};
+
+#endif
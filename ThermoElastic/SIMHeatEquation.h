@@ -16,8 +16,11 @@
 
 #include "AnaSol.h"
 #include "ASMstruct.h"
+#include "ASMs2D.h"
+#include "ASMs3D.h"
 #include "DataExporter.h"
 #include "ForceIntegrator.h"
+#include "GlobalIntegral.h"
 #include "Functions.h"
 #include "Profiler.h"
 #include "Property.h"
@@ -28,8 +31,20 @@
 #include "tinyxml.h"
 #include "LinIsotropic.h"
 #include "HeatQuantities.h"
+#include "PreconditionerPolicy.h"
+#include "PredictorCorrection.h"
+#include "StepSizeControl.h"
+#include "TensorHeatOperator.h"
+#include "GoTools/geometry/SplineSurface.h"
+#include "GoTools/trivariate/SplineVolume.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <fstream>
+#include <limits>
+#include <map>
 #include <memory>
+#include <set>
 
 
 /*!
@@ -64,6 +79,22 @@ template<class Dim, class Integrand> class SIMHeatEquation : public Dim
     bool operator()(const BoundaryFlux& b) { return abs(b.code) == myCode; }
   };
 
+  //! \brief Struct containing the data of a variant in an ensemble run.
+  struct Variant
+  {
+    std::string name;   //!< Name tagging the output of the variant
+    bool newSource;     //!< If \e true, the variant replaces the source term
+    RealFunc* source;   //!< Source function (swapped with the model's)
+    bool timeDep;       //!< Time-dependence flag of \a source
+    bool newInit;       //!< If \e true, the variant replaces the initial state
+    const RealFunc* init; //!< Initial temperature (swapped with the model's)
+    std::map<int,RealFunc*> bcs; //!< Dirichlet functions (swapped likewise)
+    Vectors temperature; //!< Temperature solution vectors of the variant
+    //! \brief Default constructor.
+    Variant() : newSource(false), source(nullptr), timeDep(true),
+                newInit(false), init(nullptr) {}
+  };
+
 public:
   struct SetupProps
   {
@@ -76,16 +107,44 @@ public:
   //! \brief Default constructor.
   //! \param[in] order Order of temporal integration (1 or 2)
   SIMHeatEquation(int order) :
-    Dim(1), he(Dim::dimension,order), wdc(Dim::dimension)
+    Dim(1), he(Dim::dimension,order), wdc(Dim::dimension,order)
   {
     Dim::myProblem = &he;
     Dim::myHeading = "Heat equation solver";
     inputContext = "heatequation";
+    reuseMatrix = haveMatrix = false;
+    lhsCoeff = 0.0;
+    maxIter = 20;
+    rTol = 1.0e-8;
+    aTol = 1.0e-12;
+    adaptTol = dtMin = dtMax = dtInit = 0.0;
+    maxReject = 10;
+    dtPrev = dtNext = 0.0;
+    nSubSteps = 0;
+    flushInc = 1;
+    cacheBudget = 0.0;
+    cacheReported = false;
+    usePredictor = false;
+    dtCur = dtLast = 0.0;
+    sharedLHS = false;
+    matrixFree = mfActive = false;
+    mfTol = 1.0e-10;
+    mfMaxIt = 1000;
+    mfKappa = mfRhoCp = 1.0;
   }
 
   //! \brief The destructor zero out the integrand pointer (deleted by parent).
+  //! \details The output files of the integrated quantities are flushed and
+  //! closed here.
   virtual ~SIMHeatEquation()
   {
+    if (pcPolicy.isActive() && pcPolicy.getNoRebuilds() > 0)
+      IFEM::cout <<"\nHeat equation preconditioner: "
+                 << pcPolicy.getNoRebuilds() <<" setups ("
+                 << pcPolicy.getRebuildTime() <<"s), "
+                 << pcPolicy.getNoReuses() <<" reuses ("
+                 << pcPolicy.getReuseTime() <<"s)"<< std::endl;
+
     Dim::myProblem = nullptr;
     Dim::myInts.clear();
   }
@@ -97,13 +156,66 @@ public:
     utl::getAttribute(elem, "type", type, true);
 
     if (type == "expression" && elem->FirstChild()) {
+      bool timeDep = true;
+      utl::getAttribute(elem, "timedependent", timeDep);
       IFEM::cout << "\n\tSource function:";
       RealFunc *func = utl::parseRealFunc(elem->FirstChild()->Value(), type);
+      if (!timeDep)
+        IFEM::cout << " (time-independent)";
       IFEM::cout << std::endl;
-      he.setSource(func);
+      he.setSource(func, timeDep);
     }
   }
 
+  //! \brief Parses an ensemble variant XML element.
+  //! \details A variant may replace the source term, the initial temperature
+  //! and the functions of inhomogeneous Dirichlet conditions given by their
+  //! property code. Everything else is shared with the model.
+  void parseVariant(const TiXmlElement* elem)
+  {
+    Variant var;
+    var.name = "variant" + std::to_string(variants.size()+1);
+    utl::getAttribute(elem,"name",var.name);
+    IFEM::cout <<"\tEnsemble variant \""<< var.name <<"\":";
+
+    const TiXmlElement* child = elem->FirstChildElement();
+    for (; child; child = child->NextSiblingElement()) {
+      int code = 0;
+      bool isSource = !strcasecmp(child->Value(),"source");
+      bool isInit = !strcasecmp(child->Value(),"initialtemperature");
+      bool isBC = !strcasecmp(child->Value(),"dirichlet") &&
+                  utl::getAttribute(child,"code",code) && code > 0;
+      if (!child->FirstChild() || !(isSource || isInit || isBC))
+        continue;
+
+      std::string type("expression");
+      utl::getAttribute(child,"type",type,true);
+      RealFunc* f = utl::parseRealFunc(child->FirstChild()->Value(),type);
+      if (!f) continue;
+
+      varFuncs.push_back(std::unique_ptr<RealFunc>(f));
+      if (isSource) {
+        // The variant sources are never cached, the point cache
+        // holds the values of the source of the model
+        var.newSource = true;
+        var.source = f;
+        IFEM::cout <<" source";
+      }
+      else if (isInit) {
+        var.newInit = true;
+        var.init = f;
+        IFEM::cout <<" initial temperature";
+      }
+      else {
+        var.bcs[code] = f;
+        IFEM::cout <<" dirichlet code="<< code;
+      }
+    }
+    IFEM::cout << std::endl;
+
+    variants.push_back(var);
+  }
+
   using Dim::parse;
   //! \brief Parses a data section from an XML element.
   virtual bool parse(const TiXmlElement* elem)
@@ -125,6 +237,13 @@ public:
       }
       return true;
     }
+    else if (!strcasecmp(elem->Value(),"postprocessing")) {
+      // The result point file is needed to tag it by the ensemble variants
+      const TiXmlElement* points = elem->FirstChildElement("resultpoints");
+      if (points)
+        utl::getAttribute(points,"file",ptFile);
+      return this->Dim::parse(elem);
+    }
     else if (strcasecmp(elem->Value(),inputContext.c_str()))
       return this->Dim::parse(elem);
 
@@ -173,12 +292,103 @@ public:
       else if (!strcasecmp(child->Value(),"source"))
         this->parseSource(child);
 
+      else if (!strcasecmp(child->Value(),"ensemble")) {
+        const TiXmlElement* var = child->FirstChildElement("variant");
+        for (; var; var = var->NextSiblingElement("variant"))
+          this->parseVariant(var);
+      }
+
+      else if (!strcasecmp(child->Value(),"nonlinear")) {
+        std::string type("newton");
+        utl::getAttribute(child,"type",type,true);
+        utl::getAttribute(child,"maxits",maxIter);
+        utl::getAttribute(child,"rtol",rTol);
+        utl::getAttribute(child,"atol",aTol);
+        he.setLinearization(type == "picard" ? Integrand::PICARD
+                                             : Integrand::NEWTON);
+        IFEM::cout <<"\tNonlinear solver: "
+                   << (type == "picard" ? "Picard" : "Newton")
+                   <<" maxits="<< maxIter <<" rtol="<< rTol
+                   <<" atol="<< aTol << std::endl;
+      }
+
+      else if (!strcasecmp(child->Value(),"adaptive")) {
+        utl::getAttribute(child,"tol",adaptTol);
+        utl::getAttribute(child,"dtmin",dtMin);
+        utl::getAttribute(child,"dtmax",dtMax);
+        utl::getAttribute(child,"dtinit",dtInit);
+        utl::getAttribute(child,"maxreject",maxReject);
+        IFEM::cout <<"\tAdaptive time stepping: tol="<< adaptTol;
+        if (dtMin > 0.0) IFEM::cout <<" dtmin="<< dtMin;
+        if (dtMax > 0.0) IFEM::cout <<" dtmax="<< dtMax;
+        IFEM::cout <<" maxreject="<< maxReject;
+        IFEM::cout << std::endl;
+      }
+
+      else if (!strcasecmp(child->Value(),"integraloutput")) {
+        utl::getAttribute(child,"flush",flushInc);
+        utl::getAttribute(child,"binary",binFile);
+        IFEM::cout <<"\tIntegral output: flush interval="<< flushInc;
+        if (!binFile.empty())
+          IFEM::cout <<" binary file="<< binFile;
+        IFEM::cout << std::endl;
+      }
+
+      else if (!strcasecmp(child->Value(),"pointcache")) {
+        cacheBudget = 100.0;
+        utl::getAttribute(child,"budget",cacheBudget);
+        IFEM::cout <<"\tPoint cache of time-independent source, budget "
+                   << cacheBudget <<" MB"<< std::endl;
+      }
+
+      else if (!strcasecmp(child->Value(),"predictor")) {
+        usePredictor = true;
+        IFEM::cout <<"\tSolving for the correction of an extrapolated"
+                   <<" temperature"<< std::endl;
+      }
+
+      else if (!strcasecmp(child->Value(),"fusedkernel")) {
+        he.setFusedKernel(true);
+        IFEM::cout <<"\tUsing fused element matrix kernel"<< std::endl;
+      }
+
+      else if (!strcasecmp(child->Value(),"preconditioner")) {
+        pcPolicy.parse(child);
+        IFEM::cout <<"\tPreconditioner reuse policy: "
+                   << pcPolicy.getName() << std::endl;
+      }
+
+      else if (!strcasecmp(child->Value(),"reusematrix")) {
+        reuseMatrix = true;
+        IFEM::cout <<"\tRe-using factorized system matrix between steps"
+                   << std::endl;
+      }
+
+      else if (!strcasecmp(child->Value(),"matrixfree")) {
+        matrixFree = true;
+        utl::getAttribute(child,"tol",mfTol);
+        utl::getAttribute(child,"maxit",mfMaxIt);
+        IFEM::cout <<"\tMatrix-free solution: tol="<< mfTol
+                   <<" maxit="<< mfMaxIt << std::endl;
+      }
+
       else
         this->Dim::parse(child);
 
     return true;
   }
 
+  //! \brief Toggles re-use of the factorized system matrix between steps.
+  //! \details This must be set before the model is preprocessed, where it is
+  //! turned off again if any material depends on the temperature.
+  void setReuseMatrix(bool reuse) { reuseMatrix = reuse; }
+  //! \brief Toggles the solution for the correction of a predictor.
+  void setPredictor(bool pred) { usePredictor = pred; }
+  //! \brief Toggles the matrix-free solution of the linear heat equation.
+  //! \details This must be set before the model is preprocessed, where it is
+  //! turned off again if the model is not supported, see initMatrixFree().
+  void setMatrixFree(bool mf) { matrixFree = mf; }
+
   //! \brief Returns the name of this simulator (for use in the HDF5 export).
   virtual std::string getName() const { return "HeatEquation"; }
 
@@ -193,6 +403,50 @@ public:
       this->registerField(str,temperature[n]);
     }
     this->setInitialConditions();
+
+    if (adaptTol > 0.0 && !variants.empty()) {
+      IFEM::cout <<"  ** Adaptive time stepping is disabled in ensemble runs."
+                 << std::endl;
+      adaptTol = 0.0;
+    }
+    else if (adaptTol > 0.0 && nSols <= 2) {
+      // The error estimate needs two previous time levels
+      IFEM::cout <<"  ** Adaptive time stepping requires BDF2,"
+                 <<" it is disabled."<< std::endl;
+      adaptTol = 0.0;
+    }
+
+    for (Variant& var : variants) {
+      var.temperature = temperature;
+      if (var.newInit)
+        for (Vector& vec : var.temperature)
+          this->evalNodal(var.init,vec);
+
+      // Only the functions of existing inhomogeneous Dirichlet conditions
+      // can be replaced, other codes are not constrained to any values
+      for (auto it = var.bcs.begin(); it != var.bcs.end();)
+        if (Dim::myScalars.find(it->first) == Dim::myScalars.end()) {
+          std::cerr <<"  ** Variant "<< var.name <<": No inhomogeneous"
+                    <<" Dirichlet condition with code "<< it->first
+                    <<", ignored."<< std::endl;
+          it = var.bcs.erase(it);
+        }
+        else
+          ++it;
+    }
+  }
+
+  //! \brief Returns the number of ensemble variants.
+  size_t getNoVariants() const { return variants.size(); }
+  //! \brief Returns the name of an ensemble variant.
+  //! \param[in] v Zero-based variant index
+  const std::string& getVariantName(size_t v) const { return variants[v].name; }
+  //! \brief Returns a solution vector of an ensemble variant.
+  //! \param[in] v Zero-based variant index
+  //! \param[in] n Time level of the solution vector
+  const Vector& getVariantSolution(size_t v, int n = 0) const
+  {
+    return variants[v].temperature[n];
   }
 
   //! \brief Opens a new VTF-file and writes the model geometry to it.
@@ -213,14 +467,41 @@ public:
   //! \brief Advances the time step one step forward.
   virtual bool advanceStep(TimeStep& tp)
   {
-    // Update temperature vectors between time steps
-    for (int n = temperature.size()-1; n > 0; n--)
-      temperature[n] = temperature[n-1];
-
+    this->shiftHistory();
     he.advanceStep();
     return true;
   }
 
+  //! \brief Updates the temperature vectors between time steps.
+  //! \details The history is rotated by swapping the vector contents, such
+  //! that the registered fields temperature1, temperature2, etc. still refer
+  //! to the same time levels without any deep copies. The current level then
+  //! holds the oldest solution, which is overwritten by the linear solve.
+  //! Only the nonlinear iterations need it as the initial iterate.
+  void shiftHistory()
+  {
+    this->shiftLevels(temperature);
+    for (Variant& var : variants)
+      this->shiftLevels(var.temperature);
+
+    dtLast = dtCur;
+  }
+
+  //! \brief Rotates the time levels of a temperature history.
+  //! \param levels The temperature vectors to rotate
+  void shiftLevels(Vectors& levels) const
+  {
+    for (int n = levels.size()-1; n > 0; n--)
+      levels[n].swap(levels[n-1]);
+
+    if (he.getLinearization() != Integrand::LINEAR)
+      levels.front() = levels[1];
+  }
+
+
+  //! \brief Returns \e true if adaptive time stepping is used.
+  bool isAdaptive() const { return adaptTol > 0.0; }
+
   //! \brief Computes the solution for the current time step.
   virtual bool solveStep(TimeStep& tp)
   {
@@ -229,16 +510,21 @@ public:
     if (Dim::msgLevel >= 0)
       IFEM::cout <<"\n  step = "<< tp.step <<"  time = "<< tp.time.t << std::endl;
 
-    Vector dummy;
-    this->updateDirichlet(tp.time.t, &dummy);
-
-    this->setMode(SIM::DYNAMIC);
-    this->setQuadratureRule(Dim::opt.nGauss[0]);
-    if (!this->assembleSystem(tp.time,temperature))
+    if (adaptTol > 0.0) {
+      if (!this->solveAdaptive(tp))
+        return false;
+    }
+    else if (!this->solveTimeLevel(tp.time) || !this->solveVariants(tp.time))
       return false;
 
-    if (!this->solveSystem(temperature.front(),Dim::msgLevel-1,"temperature "))
-      return false;
+    const PointCache& cache = he.getPointCache();
+    if (!cacheReported && !cache.empty()) {
+      IFEM::cout <<"  Point cache: "<< cache.getNoCached() <<" of "
+                 << cache.getNoRequested() <<" points cached, capacity "
+                 << cache.getCapacity() <<" points ("<< cache.getMemory()
+                 <<" MB)"<< std::endl;
+      cacheReported = true;
+    }
 
     if (Dim::msgLevel == 1)
     {
@@ -253,6 +539,351 @@ public:
     return true;
   }
 
+  //! \brief Computes the temperature at a given time level.
+  //! \param[in] time Time domain of the time level to solve for
+  //! \details With a predictor, the system is solved for the correction of
+  //! a temperature extrapolated from the previous time levels, see
+  //! PredictorCorrection. An iterative equation solver then effectively
+  //! starts from the extrapolated value. This requires the assembled system
+  //! matrix, which is only available when it has been re-assembled, or with
+  //! an iterative equation solver.
+  bool solveTimeLevel(const TimeDomain& time)
+  {
+    Vector dummy;
+    this->updateDirichlet(time.t,&dummy);
+    dtCur = time.dt;
+
+    this->setQuadratureRule(Dim::opt.nGauss[0]);
+    if (he.getLinearization() != Integrand::LINEAR)
+      return this->solveNonlinear(time);
+    else if (mfActive)
+      return this->solveMatrixFree(time);
+
+    bool newLHS = !sharedLHS && this->needNewMatrix(time.dt);
+    this->setMode(newLHS ? SIM::DYNAMIC : SIM::RHS_ONLY);
+    if (!this->assembleSystem(time,temperature,newLHS))
+      return false;
+
+    PredictorCorrection correction;
+    if (usePredictor && (newLHS || Dim::opt.solver == LinAlg::PETSC ||
+                         Dim::opt.solver == LinAlg::ISTL)) {
+      this->predict(time.dt);
+      if (!correction.apply(*this,prediction))
+        return false;
+    }
+
+    if (!this->solveLinear(newLHS))
+      return false;
+
+    return !correction.isActive() ||
+           correction.update(*this,temperature.front());
+  }
+
+  //! \brief Computes the temperatures of the ensemble variants.
+  //! \param[in] time Time domain of the time level to solve for
+  //! \details The variants share the model, the equation numbering and the
+  //! equation solver. When the system matrix is re-used between steps, the
+  //! matrix factorized for the model is also used for all variants, such that
+  //! each variant only costs a right-hand-side assembly and a solve with the
+  //! existing factorization.
+  bool solveVariants(const TimeDomain& time)
+  {
+    for (Variant& var : variants) {
+      if (Dim::msgLevel > 0)
+        IFEM::cout <<"  variant "<< var.name << std::endl;
+
+      this->swapVariant(var);
+      sharedLHS = reuseMatrix;
+      bool ok = this->solveTimeLevel(time);
+      sharedLHS = false;
+      this->swapVariant(var);
+      if (!ok) return false;
+    }
+
+    return true;
+  }
+
+  //! \brief Swaps the solution and functions of the model with a variant.
+  //! \param var The ensemble variant to swap with
+  //! \details The vector contents are swapped, such that the registered
+  //! fields refer to the active variant. Swapping twice restores the model.
+  void swapVariant(Variant& var)
+  {
+    for (size_t n = 0; n < temperature.size(); n++)
+      temperature[n].swap(var.temperature[n]);
+
+    if (var.newSource) {
+      RealFunc* src = he.getSourceTerm();
+      bool timeDep = !he.hasStaticSource();
+      he.setSource(var.source,var.timeDep);
+      var.source = src;
+      var.timeDep = timeDep;
+    }
+
+    // The stored energy is relative to the initial temperature function
+    if (var.newInit) {
+      const RealFunc* init = he.getInitialTemperature();
+      he.setInitialTemperature(var.init);
+      var.init = init;
+    }
+
+    for (std::pair<const int,RealFunc*>& bc : var.bcs)
+      std::swap(Dim::myScalars[bc.first],bc.second);
+  }
+
+  //! \brief Evaluates a function at the nodal points of the model.
+  //! \param[in] f The function to evaluate
+  //! \param vec The nodal values
+  void evalNodal(const RealFunc* f, Vector& vec)
+  {
+    for (int i = 0; i < this->getNoPatches(); i++) {
+      int loc = this->getLocalPatchIndex(i+1);
+      if (loc > 0) {
+        Vector locvec;
+        this->getPatch(loc)->evaluate(f,locvec);
+        this->getPatch(loc)->injectNodeVec(locvec,vec,1);
+      }
+    }
+  }
+
+  //! \brief Extrapolates the temperature from the previous time levels.
+  //! \param[in] dt Time step size of the current time level
+  //! \details The extrapolation is linear when two previous time levels
+  //! are available, and constant otherwise.
+  void predict(double dt)
+  {
+    prediction = temperature[1];
+    if (temperature.size() > 2 && he.getBDFOrder() > 1 && dtLast > 0.0) {
+      double w = dt/dtLast;
+      prediction *= 1.0 + w;
+      prediction.add(temperature[2],-w);
+    }
+  }
+
+  //! \brief Computes the temperature by the matrix-free operator.
+  //! \param[in] time Time domain of the time level to solve for
+  //! \details Only the right-hand-side is assembled. The system is solved by
+  //! conjugate gradients with the sum-factorized operator, starting from the
+  //! temperature of the previous time level.
+  bool solveMatrixFree(const TimeDomain& time)
+  {
+    PROFILE2("Matrix-free solution");
+
+    this->setMode(SIM::RHS_ONLY);
+    if (!this->assembleSystem(time,temperature,false))
+      return false;
+
+    const SAM* sam = this->getSAM();
+    SystemVector* b = this->getRHSvector();
+    ASMbase* pch = this->getPatch(1);
+    if (!sam || !b || !pch)
+      return false;
+
+    // Map between the equation order and the tensor-product node order
+    size_t nnod = mfOp.size();
+    std::vector<bool> fixed(nnod,false);
+    std::vector<double> rhs(nnod,0.0), x(nnod,0.0);
+    const Vector& prev = temperature[temperature.size() > 1 ? 1 : 0];
+    const Real* bval = b->getPtr();
+    for (size_t i = 0; i < nnod; i++) {
+      int node = pch->getNodeID(1+i);
+      int ieq = sam->getEquation(node,1);
+      if (ieq < 0) {
+        std::cerr <<" *** SIMHeatEquation::solveMatrixFree: Multi-point"
+                  <<" constraints are not supported."<< std::endl;
+        return false;
+      }
+      fixed[i] = ieq == 0;
+      if (ieq > 0)
+        rhs[i] = bval[ieq-1];
+      if (node > 0 && (size_t)node <= prev.size())
+        x[i] = prev(node);
+    }
+
+    mfOp.setCoefficients(mfKappa,mfRhoCp*he.getBDFCoeff(0)/time.dt);
+    int nIt = mfOp.solve(fixed,rhs,x,mfTol,mfMaxIt);
+    if (nIt < 0) {
+      std::cerr <<" *** SIMHeatEquation::solveMatrixFree: No convergence in "
+                << -nIt <<" iterations."<< std::endl;
+      return false;
+    }
+    else if (Dim::msgLevel > 1)
+      IFEM::cout <<"  Matrix-free solution: "<< nIt <<" iterations"
+                 << std::endl;
+
+    Vector& T = temperature.front();
+    T.resize(this->getNoDOFs());
+    for (size_t i = 0; i < nnod; i++) {
+      int node = pch->getNodeID(1+i);
+      if (node > 0 && (size_t)node <= T.size())
+        T(node) = fixed[i] ? 0.0 : x[i];
+    }
+
+    return true;
+  }
+
+  //! \brief Solves the assembled linear system for the temperature.
+  //! \param[in] newLHS If \e true, the system matrix has been re-assembled
+  //! \details With an iterative equation solver, the preconditioner of the
+  //! previous matrix can be reused for a new matrix, as decided by the
+  //! preconditioner reuse policy.
+  bool solveLinear(bool newLHS)
+  {
+    if (!pcPolicy.isActive() || (Dim::opt.solver != LinAlg::PETSC &&
+                                 Dim::opt.solver != LinAlg::ISTL))
+      return this->solveSystem(temperature.front(),Dim::msgLevel-1,nullptr,
+                               "temperature ",newLHS);
+
+    bool newPC = pcPolicy.rebuild(newLHS);
+    auto start = std::chrono::steady_clock::now();
+    if (!this->solveSystem(temperature.front(),Dim::msgLevel-1,nullptr,
+                           "temperature ",newPC))
+      return false;
+
+    std::chrono::duration<double> time = std::chrono::steady_clock::now()-start;
+    pcPolicy.update(newPC,time.count());
+    if (Dim::msgLevel > 1)
+      IFEM::cout <<"  Preconditioner "<< (newPC ? "set up" : "reused")
+                 <<", solve time "<< time.count() <<"s"<< std::endl;
+
+    return true;
+  }
+
+  //! \brief Advances the solution over a time step with adaptive sub-steps.
+  //! \param[in] tp Time stepping parameters
+  //! \details The step size of \a tp acts as the output interval. It is
+  //! covered by sub-steps using variable step size BDF2. The local error of
+  //! each sub-step is estimated by comparing the solution to the linear
+  //! extrapolation from the two previous time levels. Sub-steps with a too
+  //! large error are rejected and repeated with a smaller step size, see
+  //! StepSizeControl. The minimum sub-step size defaults to 1.0e-4 times the
+  //! output interval. The time step fails if a sub-step of the minimum size
+  //! is rejected, if too many consecutive sub-steps are rejected, or if the
+  //! error estimate is not finite.
+  bool solveAdaptive(const TimeStep& tp)
+  {
+    const double eps = 1.0e-10*tp.time.dt;
+    double tEnd = tp.time.t;
+    double t = tEnd - tp.time.dt;
+    StepSizeControl control(adaptTol,dtMin > 0.0 ? dtMin : 1.0e-4*tp.time.dt,
+                            dtMax > 0.0 ? dtMax : tp.time.dt,maxReject);
+    if (dtNext <= 0.0)
+      dtNext = dtInit > 0.0 ? dtInit : tp.time.dt;
+
+    TimeDomain time(tp.time);
+    bool shift = false; // the history is already shifted by advanceStep()
+    while (t < tEnd-eps) {
+      double dt = std::min(dtNext,tEnd-t);
+      bool truncated = dt < dtNext;
+      if (shift)
+        this->shiftHistory();
+
+      // Variable step size BDF2, or BDF1 for the very first step
+      he.setVariableBDF(nSubSteps > 0 ? dt/dtPrev : 0.0);
+      time.t = t + dt;
+      time.dt = dt;
+      if (!this->solveTimeLevel(time))
+        return false;
+
+      // Estimate the local error from the extrapolated predictor
+      double err = -1.0; // no estimate for the very first step
+      if (nSubSteps > 0) {
+        double omega = dt/dtPrev;
+        Vector diff(temperature.front());
+        diff.add(temperature[1],-(1.0+omega));
+        diff.add(temperature[2],omega);
+        err = diff.norm2() / std::max(temperature.front().norm2(),1.0e-16);
+      }
+      StepSizeControl::Decision status = control.check(err,dt);
+      double dtNew = control.getStepSize();
+
+      if (Dim::msgLevel > 0)
+        IFEM::cout <<"  sub-step t = "<< time.t <<"  dt = "<< dt
+                   <<"  error = "<< std::max(err,0.0)
+                   << (status == StepSizeControl::REJECT ? "  (rejected)" : "")
+                   << std::endl;
+
+      if (status == StepSizeControl::FAIL) {
+        std::cerr <<" *** SIMHeatEquation::solveAdaptive: Sub-step at t = "
+                  << time.t <<" with dt = "<< dt <<" failed, error = "<< err;
+        if (control.getNoRejections() > maxReject)
+          std::cerr <<" after "<< maxReject <<" rejected sub-steps.";
+        else if (std::isfinite(err))
+          std::cerr <<" at the minimum step size.";
+        std::cerr << std::endl;
+        return false;
+      }
+      else if (status == StepSizeControl::REJECT) {
+        // Reject the sub-step and retry with a smaller step size
+        temperature.front() = temperature[1];
+        dtNext = dtNew;
+        shift = false;
+        continue;
+      }
+
+      if (!truncated || dtNew < dtNext)
+        dtNext = dtNew;
+      t += dt;
+      dtPrev = dt;
+      ++nSubSteps;
+      shift = true;
+    }
+
+    return true;
+  }
+
+  //! \brief Iterates on the temperature of current time step.
+  //! \param[in] time Time domain of current time step
+  //! \details Each iteration solves for the new iterate directly, with the
+  //! material evaluated at the previous iterate (Picard), or with the
+  //! consistent tangent including the material derivatives (Newton).
+  //! If a Newton iteration fails to reduce the temperature change,
+  //! the remaining iterations are done with Picard linearization.
+  bool solveNonlinear(const TimeDomain& time)
+  {
+    typename Integrand::Linearization lin = he.getLinearization();
+
+    this->setMode(SIM::DYNAMIC);
+    double prevNorm = 0.0;
+    for (int it = 1; it <= maxIter; it++) {
+      Vector prevT(temperature.front());
+      wdc.setNewtonTangent(he.getLinearization() == Integrand::NEWTON);
+      if (!this->assembleSystem(time,temperature))
+        return false;
+
+      if (!this->solveSystem(temperature.front(),Dim::msgLevel-1,
+                             "temperature "))
+        return false;
+
+      prevT -= temperature.front();
+      double dNorm = prevT.norm2();
+      double tNorm = temperature.front().norm2();
+      if (Dim::msgLevel > 0)
+        IFEM::cout <<"  iter = "<< it <<"  |dT| = "<< dNorm
+                   <<"  |T| = "<< tNorm << std::endl;
+
+      if (dNorm <= aTol || dNorm <= rTol*tNorm) {
+        he.setLinearization(lin);
+        wdc.setNewtonTangent(false);
+        return true;
+      }
+
+      if (he.getLinearization() == Integrand::NEWTON &&
+          it > 1 && dNorm > prevNorm) {
+        IFEM::cout <<"  ** Newton iterations diverging,"
+                   <<" switching to Picard."<< std::endl;
+        he.setLinearization(Integrand::PICARD);
+      }
+      prevNorm = dNorm;
+    }
+
+    he.setLinearization(lin);
+    wdc.setNewtonTangent(false);
+    std::cerr <<" *** SIMHeatEquation::solveNonlinear: No convergence in "
+              << maxIter <<" iterations."<< std::endl;
+    return false;
+  }
+
   //! \brief Dummy method.
   bool postSolve(const TimeStep&, bool = false) { return true; }
 
@@ -279,65 +910,217 @@ public:
     IFEM::cout << std::endl;
   }
 
-  //! \brief Compute and save a boundary heat flux or the stored energy in a volume
+  //! \brief Checks whether an integral is to be computed in a time step.
   //! \param[in] bf Description of integration domain
   //! \param[in] tp Time stepping information
-  //! \param[in] flux True to calculate a heat flux, false for stored energy
-  bool saveIntegral(const BoundaryFlux& bf, const TimeStep& tp, bool flux)
+  static bool isActive(const BoundaryFlux& bf, const TimeStep& tp)
   {
-    if (bf.code == 0 || bf.timeIncr < 1 || bf.set.empty()) return true;
-    if (tp.step < 1 || (tp.step-1)%bf.timeIncr > 0) return true;
+    if (bf.code == 0 || bf.timeIncr < 1 || bf.set.empty()) return false;
+    return tp.step >= 1 && (tp.step-1)%bf.timeIncr == 0;
+  }
+
+  //! \brief Computes and saves the boundary heat fluxes and stored energies.
+  //! \param[in] tp Time stepping information
+  //! \details All sets that are due in this step are integrated in a single
+  //! pass over the patches and patch boundaries, with one integral
+  //! component per set. A patch or patch boundary shared by several sets is
+  //! integrated once, adding to all of them. The results are written
+  //! afterwards.
+  bool saveIntegrals(const TimeStep& tp)
+  {
+    std::vector<const BoundaryFlux*> sets;
+    std::vector<bool> isFlux;
+    for (const BoundaryFlux& bf : fluxes)
+      if (isActive(bf,tp)) {
+        sets.push_back(&bf);
+        isFlux.push_back(true);
+      }
+    for (const BoundaryFlux& bf : senergy)
+      if (isActive(bf,tp)) {
+        sets.push_back(&bf);
+        isFlux.push_back(false);
+      }
+
+    if (sets.empty())
+      return true;
 
     Vector integral;
+    {
+      PROFILE2("Heat flux and stored energy integration");
+
+      HeatEquationIntegrals<Integrand> integrals(he,sets.size());
+      integrals.initBuffer(this->getNoElms());
+
+      // Group the sets by patch and patch boundary, such that each of them
+      // is integrated only once. Properties on the patch boundaries have a
+      // lower parametric dimension than the model, and contribute to the
+      // heat fluxes. The other properties contribute to the stored energies.
+      typedef std::pair<size_t,int> PatchFace;
+      std::map< PatchFace,std::vector<size_t> > groups;
+      for (const Property& p : Dim::myProps)
+        for (size_t k = 0; k < sets.size(); k++) {
+          bool boundary = p.ldim < Dim::dimension;
+          if (abs(p.pindx) == abs(sets[k]->code) && isFlux[k] == boundary) {
+            PatchFace face(p.patch,boundary ? abs(p.lindx) : 0);
+            std::vector<size_t>& group = groups[face];
+            if (std::find(group.begin(),group.end(),k) == group.end())
+              group.push_back(k);
+          }
+        }
 
-    if (flux)
-      integral = SIM::getBoundaryForce(temperature,this,bf.code,tp.time);
-    else {
-      HeatEquationStoredEnergy<Integrand> energy(he);
-      energy.initBuffer(this->getNoElms());
-      SIM::integrate(temperature,this,bf.code,tp.time,&energy);
-      energy.assemble(integral);
+      GlobalIntegral dummy;
+      size_t lastPatch = 0;
+      for (const std::pair<const PatchFace,std::vector<size_t>>& g : groups) {
+        ASMbase* pch = this->getPatch(g.first.first);
+        if (!pch) continue;
+
+        // Extract the temperatures of this patch only once
+        if (g.first.first != lastPatch &&
+            !this->extractPatchSolution(temperature,g.first.first-1))
+          return false;
+        lastPatch = g.first.first;
+
+        integrals.setActive(g.second);
+        bool ok;
+        if (g.first.second > 0)
+          ok = pch->integrate(integrals,g.first.second,dummy,tp.time);
+        else
+          ok = pch->integrate(integrals,dummy,tp.time);
+        if (!ok)
+          return false;
+      }
+
+      integrals.assemble(integral);
+#ifdef HAVE_MPI
+      Dim::adm.allReduce(integral,MPI_SUM);
+#endif
     }
 
-    if (integral.empty())
+    if (integral.size() < sets.size())
       return false;
 
-    std::ostream* os = &std::cout;
-    std::stringstream str;
+    for (size_t k = 0; k < sets.size(); k++)
+      this->writeIntegral(*sets[k],tp,isFlux[k],integral[k]);
+    this->writeBinary(tp,sets,isFlux,integral);
 
-    if (Dim::myPid == 0) {
-      if (bf.file.empty())
+    // Flush the output files regularly and at restart dumps
+    int dumpInc = this->getDumpInterval();
+    if ((flushInc > 0 && tp.step%flushInc == 0) ||
+        (dumpInc > 0 && tp.step%dumpInc == 0))
+      this->flushIntegrals();
+
+    return true;
+  }
+
+  //! \brief Writes a boundary heat flux or the stored energy in a volume.
+  //! \param[in] bf Description of integration domain
+  //! \param[in] tp Time stepping information
+  //! \param[in] flux True for a heat flux, false for stored energy
+  //! \param[in] value The integrated value
+  //! \details The output file of each set is opened on first use and kept
+  //! open for the rest of the simulation.
+  void writeIntegral(const BoundaryFlux& bf, const TimeStep& tp,
+                     bool flux, double value)
+  {
+    char line[256];
+    if (bf.file.empty()) {
+      if (Dim::myPid == 0)
         std::cout << std::endl;
-      else
-        os = new std::ofstream(bf.file.c_str(),
-                               tp.step == 1 ? std::ios::out : std::ios::app);
+      if (!outputTag.empty())
+        IFEM::cout << outputTag <<": ";
+      snprintf(line,sizeof(line),"%10.6f %11.6g\n",tp.time.t,value);
+      IFEM::cout << line;
+      return;
+    }
+    else if (Dim::myPid != 0)
+      return;
+
+    std::string file = this->taggedFile(bf.file);
+    std::unique_ptr<std::ofstream>& os = outFiles[file];
+    if (!os)
+      os.reset(new std::ofstream(file.c_str(), tp.step == 1 ? std::ios::out
+                                                            : std::ios::app));
+
+    if (tp.step == 1) {
+      *os << (flux ? "# Heat flux over surface" : "# Stored energy in volume")
+          <<" with code "<< bf.code << std::endl;
+      snprintf(line,sizeof(line),"#%9s %11s\n","time",flux ? "Flux" : "Energy");
+      *os << line;
+    }
+
+    snprintf(line,sizeof(line),"%10.6f %11.6g\n",tp.time.t,value);
+    *os << line;
+  }
+
+  //! \brief Writes one record of the binary integral output file.
+  //! \param[in] tp Time stepping information
+  //! \param[in] sets The sets that were integrated in this step
+  //! \param[in] isFlux True for the heat flux sets in \a sets
+  //! \param[in] integral The integrated values of \a sets
+  //! \details The file starts with the 8-byte tag \a IFEMINT1, the number of
+  //! sets and a (code,type) pair for each set, where type is 0 for heat fluxes
+  //! and 1 for stored energies, all as 32-bit integers. Each record then holds
+  //! the time followed by one value per set, as doubles. Sets that were not
+  //! evaluated in a step are written as NaN.
+  void writeBinary(const TimeStep& tp,
+                   const std::vector<const BoundaryFlux*>& sets,
+                   const std::vector<bool>& isFlux, const Vector& integral)
+  {
+    if (binFile.empty() || Dim::myPid != 0)
+      return;
 
-      char line[256];
+    std::string file = this->taggedFile(binFile);
+    std::unique_ptr<std::ofstream>& binOut = outFiles[file];
+    if (!binOut) {
+      binOut.reset(new std::ofstream(file.c_str(), tp.step == 1 ?
+                                     std::ios::out | std::ios::binary :
+                                     std::ios::app | std::ios::binary));
       if (tp.step == 1) {
-        *os << (flux ? "# Heat flux over surface" : "# Stored energy in volume")
-            <<" with code "<< bf.code << std::endl;
-        sprintf(line,"#%9s %11s\n", "time", flux ? "Flux" : "Energy");
-        *os << line;
+        int nSets = fluxes.size() + senergy.size();
+        binOut->write("IFEMINT1",8);
+        binOut->write(reinterpret_cast<const char*>(&nSets),sizeof(int));
+        for (int type = 0; type < 2; type++)
+          for (const BoundaryFlux& bf : type == 0 ? fluxes : senergy) {
+            binOut->write(reinterpret_cast<const char*>(&bf.code),sizeof(int));
+            binOut->write(reinterpret_cast<const char*>(&type),sizeof(int));
+          }
       }
-
-      sprintf(line,"%10.6f", tp.time.t);
-      str << line;
-      sprintf(line," %11.6g", integral[0]);
-      str << line;
-      str << '\n';
     }
 
-    if (bf.file.empty())
-      IFEM::cout << str.str();
-    else if (Dim::myPid == 0)
-    {
-      *os << str.str();
-      delete os;
-    }
+    std::vector<double> record(1+fluxes.size()+senergy.size(),
+                               std::numeric_limits<double>::quiet_NaN());
+    record.front() = tp.time.t;
+    for (size_t k = 0; k < sets.size(); k++)
+      if (isFlux[k])
+        record[1 + (sets[k]-fluxes.data())] = integral[k];
+      else
+        record[1 + fluxes.size() + (sets[k]-senergy.data())] = integral[k];
+    binOut->write(reinterpret_cast<const char*>(record.data()),
+                  record.size()*sizeof(double));
+  }
 
-    return true;
+  //! \brief Flushes the output files of the integrated quantities.
+  void flushIntegrals()
+  {
+    for (auto& os : outFiles)
+      os.second->flush();
   }
 
+  //! \brief Returns the name of an output file tagged by the active variant.
+  //! \param[in] file The output file name of the model
+  //! \details The variant name is inserted in front of the file extension.
+  std::string taggedFile(const std::string& file) const
+  {
+    if (outputTag.empty())
+      return file;
+
+    size_t dot = file.find_last_of('.');
+    size_t slash = file.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+      return file + "_" + outputTag;
+
+    return file.substr(0,dot) + "_" + outputTag + file.substr(dot);
+  }
 
   //! \brief Saves the converged results to VTF file of a given time step.
   //! \param[in] tp Time step identifier
@@ -346,16 +1129,30 @@ public:
   {
     PROFILE1("SIMHeatEquation::saveStep");
 
-    bool ok = true;
-    for (size_t i = 0; i < fluxes.size(); ++i)
-      ok &= this->saveIntegral(fluxes[i],tp,true);
-
-    for (size_t i = 0; i < senergy.size(); ++i)
-      ok &= this->saveIntegral(senergy[i],tp,false);
+    bool ok = this->saveIntegrals(tp);
+    for (Variant& var : variants) {
+      this->swapVariant(var);
+      outputTag = var.name;
+      ok &= this->saveIntegrals(tp);
+      outputTag.clear();
+      this->swapVariant(var);
+    }
+    if (tp.step%Dim::opt.saveInc == 0 && Dim::opt.format >= 0)
+      this->flushIntegrals();
 
     double old = utl::zero_print_tol;
     utl::zero_print_tol = 1e-16;
     ok &= this->savePoints(temperature.front(),tp.time.t,tp.step);
+    if (!ptFile.empty() && !variants.empty()) {
+      // Each variant writes its own result point file
+      for (Variant& var : variants) {
+        outputTag = var.name;
+        this->setPointResultFile(this->taggedFile(ptFile));
+        ok &= this->savePoints(var.temperature.front(),tp.time.t,tp.step);
+      }
+      outputTag.clear();
+      this->setPointResultFile(ptFile);
+    }
     utl::zero_print_tol = old;
 
     if (tp.step%Dim::opt.saveInc > 0 || Dim::opt.format < 0 || !ok)
@@ -368,6 +1165,13 @@ public:
                          tp.time.t,"temperature",89) < 0)
       return false;
 
+    for (size_t v = 0; v < variants.size(); v++) {
+      std::string name = "temperature_" + variants[v].name;
+      if (this->writeGlvS1(variants[v].temperature.front(),iDump,nBlock,
+                           tp.time.t,name.c_str(),100+10*v) < 0)
+        return false;
+    }
+
     return this->writeGlvStep(iDump,tp.time.t);
   }
 
@@ -380,6 +1184,16 @@ public:
                            DataExporter::PRIMARY|DataExporter::RESTART,
                            prefix);
     exporter.setFieldValue("theta", this, &temperature.front());
+
+    // The ensemble variants are written as primary fields only. The names
+    // of the field data are derived from the prefix, which therefore must
+    // be unique for each variant.
+    for (Variant& var : variants) {
+      std::string varPrefix = prefix.empty() ? var.name : prefix+"_"+var.name;
+      exporter.registerField("theta_"+var.name,"temperature_"+var.name,
+                             DataExporter::SIM,DataExporter::PRIMARY,varPrefix);
+      exporter.setFieldValue("theta_"+var.name, this, &var.temperature.front());
+    }
   }
 
   double externalEnergy(const Vectors&) const { return 0.0; }
@@ -404,21 +1218,247 @@ public:
   const RealFunc* getInitialTemperature() const { return he.getInitialTemperature(); }
 
 protected:
+  //! \brief Checks whether the system matrix needs to be re-assembled.
+  //! \param[in] dt Current time step size
+  //! \details The matrix of the linear heat equation only depends on the
+  //! material, the time step size and the leading BDF coefficient. If the user
+  //! has asserted that the material is temperature-independent, the assembled
+  //! and factorized matrix is kept until one of the latter two changes.
+  bool needNewMatrix(double dt)
+  {
+    double coeff = he.getBDFCoeff(0)/dt;
+    bool newLHS = !reuseMatrix || !haveMatrix ||
+                  fabs(coeff-lhsCoeff) > 1.0e-12*fabs(coeff);
+    if (newLHS && reuseMatrix && haveMatrix && Dim::msgLevel > 1)
+      IFEM::cout <<"  Time step or BDF order changed, new system matrix"
+                 << std::endl;
+
+    lhsCoeff = coeff;
+    haveMatrix = true;
+    return newLHS;
+  }
+
+  //! \brief Sets up the matrix-free operator of the linear heat equation.
+  //! \details The operator is only available for linear models with a single
+  //! non-rational, axis-aligned box-shaped spline patch, a constant
+  //! temperature-independent material, homogeneous Dirichlet conditions and
+  //! no Robin or weak Dirichlet conditions. The model is checked here, and
+  //! the assembled system matrix is used if any of these do not hold.
+  //! The system matrix is still allocated, but never assembled.
+  bool initMatrixFree()
+  {
+    const char* reason = nullptr;
+    if (he.getLinearization() != Integrand::LINEAR)
+      reason = "nonlinear model";
+    else if (this->getNoPatches() != 1 || Dim::adm.getNoProcs() > 1)
+      reason = "more than one patch";
+    else if (this->hasInhomogeneousDirichlet())
+      reason = "inhomogeneous Dirichlet conditions";
+
+    for (const Property& p : Dim::myProps)
+      if (p.pcode == Property::ROBIN || p.pcode == Property::NEUMANN_GENERIC)
+        reason = "Robin or weak Dirichlet conditions";
+
+    // The univariate knot vectors of the patch
+    ASMbase* pch = this->getPatch(1);
+    std::vector< std::vector<double> > knots;
+    std::vector<int> order;
+    if (!reason && Dim::dimension == 2 && dynamic_cast<ASMs2D*>(pch)) {
+      const Go::SplineSurface* srf = static_cast<ASMs2D*>(pch)->getSurface();
+      if (srf && !srf->rational())
+        for (int d = 0; d < 2; d++) {
+          const Go::BsplineBasis& basis = d == 0 ? srf->basis_u()
+                                                 : srf->basis_v();
+          knots.push_back(std::vector<double>(basis.begin(),basis.end()));
+          order.push_back(basis.order());
+        }
+    }
+    else if (!reason && Dim::dimension == 3 && dynamic_cast<ASMs3D*>(pch)) {
+      const Go::SplineVolume* vol = static_cast<ASMs3D*>(pch)->getVolume();
+      if (vol && !vol->rational())
+        for (int d = 0; d < 3; d++) {
+          const Go::BsplineBasis& basis = vol->basis(d);
+          knots.push_back(std::vector<double>(basis.begin(),basis.end()));
+          order.push_back(basis.order());
+        }
+    }
+    if (!reason && knots.empty())
+      reason = "no non-rational tensor-product spline patch";
+
+    // The geometry must be the affine image of the parameter domain,
+    // i.e., the nodes are at the scaled Greville points
+    std::vector<double> length(knots.size(),0.0);
+    std::vector<size_t> n(knots.size(),1);
+    size_t nnod = 1;
+    for (size_t d = 0; d < knots.size(); d++) {
+      n[d] = knots[d].size() - order[d];
+      nnod *= n[d];
+    }
+    if (!reason && nnod != pch->getNoNodes())
+      reason = "unexpected number of nodes";
+
+    if (!reason) {
+      Vec3 X0 = pch->getCoord(1);
+      for (size_t d = 0, stride = 1; d < knots.size(); stride *= n[d++])
+        length[d] = pch->getCoord(1+stride*(n[d]-1))[d] - X0[d];
+
+      double tol = 1.0e-10*std::max(1.0,*std::max_element(length.begin(),
+                                                          length.end()));
+      for (size_t i = 0; i < nnod && !reason; i++) {
+        Vec3 X = pch->getCoord(1+i);
+        for (size_t d = 0, j = i; d < 3 && !reason; d++) {
+          double x = X0[d];
+          if (d < knots.size()) {
+            const std::vector<double>& U = knots[d];
+            int p = order[d]-1;
+            double g = 0.0;
+            for (int k = 1; k <= p; k++)
+              g += U[j%n[d]+k];
+            if (p > 0) g /= p;
+            x += (g-U[p])/(U[n[d]]-U[p])*length[d];
+            j /= n[d];
+          }
+          if (fabs(X[d]-x) > tol)
+            reason = "the patch is not an axis-aligned box";
+        }
+      }
+    }
+
+    // The material must be constant. Elements without a material property
+    // use the material set by initMaterial(), which is only unique if the
+    // model has at most one material.
+    const Material* def = mVec.size() == 1 ? mVec.front().get() : nullptr;
+    const Material* mat = nullptr;
+    for (size_t e = 0; e < elmMat.size() && !reason; e++) {
+      const Material* emat = elmMat[e] ? elmMat[e] : def;
+      if (!emat && mVec.size() > 1)
+        reason = "elements without material";
+      else if (e == 0)
+        mat = emat;
+      else if (emat != mat)
+        reason = "more than one material";
+    }
+    if (!reason && mat && Integrand::isTempDependent(mat))
+      reason = "temperature-dependent material";
+
+    for (size_t i = 0; i < nnod && !reason && mat; i++) {
+      Vec3 X = pch->getCoord(1+i);
+      double rhocp = mat->getMassDensity(X)*mat->getHeatCapacity(0.0);
+      double kappa = mat->getThermalConductivity(0.0);
+      if (i == 0) {
+        mfRhoCp = rhocp;
+        mfKappa = kappa;
+      }
+      else if (fabs(rhocp-mfRhoCp) > 1.0e-12*fabs(mfRhoCp) ||
+               fabs(kappa-mfKappa) > 1.0e-12*fabs(mfKappa))
+        reason = "spatially varying material";
+    }
+
+    if (!reason && !mfOp.init(knots,order,length))
+      reason = "invalid spline basis";
+
+    mfActive = !reason;
+    if (reason)
+      IFEM::cout <<"  ** Matrix-free solution is not supported ("<< reason
+                 <<"), using the assembled matrix."<< std::endl;
+    else
+      IFEM::cout <<"\tMatrix-free solution with "<< mfOp.size()
+                 <<" unknowns."<< std::endl;
+
+    return mfActive;
+  }
+
+  //! \brief Returns \e true if the model has inhomogeneous Dirichlet conditions.
+  bool hasInhomogeneousDirichlet() const
+  {
+    for (const Property& p : Dim::myProps)
+      if (p.pcode == Property::DIRICHLET_INHOM ||
+          p.pcode == Property::DIRICHLET_ANASOL)
+        return true;
+
+    return false;
+  }
+
   //! \brief Performs some pre-processing tasks on the FE model.
   //! \details This method is reimplemented to ensure that threading groups are
-  //! established for the patch faces subjected to boundary flux integration.
+  //! established for the patch faces subjected to boundary integration,
+  //! i.e., Neumann and Robin conditions and boundary flux calculation.
+  //! It also checks whether the element matrices are needed when assembling
+  //! the right-hand-side only.
   virtual bool preprocessB()
   {
+    bool inhomDirichlet = this->hasInhomogeneousDirichlet();
+    he.setDirichletLHS(inhomDirichlet);
+    wdc.setDirichletLHS(inhomDirichlet);
+
+    // Resolve the material of each element up front, such that the
+    // integrands do not depend on the material set by initMaterial()
+    elmMat.assign(this->getNoElms(),nullptr);
+    for (const Property& p : Dim::myProps)
+      if (p.pcode == Property::MATERIAL && (size_t)p.pindx < mVec.size()) {
+        ASMbase* pch = this->getPatch(p.patch);
+        for (size_t e = 1; pch && e <= pch->getNoElms(); e++) {
+          int iel = pch->getElmID(e);
+          if (iel > 0 && iel <= (int)elmMat.size())
+            elmMat[iel-1] = mVec[p.pindx].get();
+        }
+      }
+    he.setElementMaterials(&elmMat);
+    wdc.setElementMaterials(&elmMat);
+
+    // The system matrix can only be re-used if it is independent of the
+    // temperature, i.e., for a temperature-independent material
+    haveMatrix = false;
+    for (size_t i = 0; i < mVec.size() && reuseMatrix; i++)
+      if (Integrand::isTempDependent(mVec[i].get())) {
+        IFEM::cout <<"  ** Temperature-dependent material,"
+                   <<" the system matrix is not re-used."<< std::endl;
+        reuseMatrix = false;
+      }
+
+    // A time-independent source term is cached, with the default budget
+    // unless specified. Other quantities are cheaper to re-evaluate.
+    if (he.hasStaticSource()) {
+      if (cacheBudget <= 0.0)
+        cacheBudget = 100.0;
+      // Estimated number of interior integration points,
+      // points beyond this estimate are simply not cached
+      int nGP = Dim::opt.nGauss[0] > 0 ? Dim::opt.nGauss[0] : 4;
+      size_t nPoints = this->getNoElms();
+      for (unsigned char d = 0; d < Dim::dimension; d++)
+        nPoints *= nGP;
+      he.initPointCache(nPoints,cacheBudget);
+    }
+
+    mfActive = false;
+    if (matrixFree)
+      this->initMatrixFree();
+
+    // Without linearization, the current temperature is not available during
+    // the assembly, so the materials use the previous time level
+    wdc.setMaterialLevel(he.getLinearization() == Integrand::LINEAR ? 1 : 0);
+
+    // Establish threading groups for all patch boundaries that are subjected
+    // to boundary integrals, either in the assembly or in the post-processing.
+    // The volume sets use the element threading groups of the patches.
+    std::set< std::pair<size_t,int> > done;
     PropertyVec::const_iterator p;
     for (p = Dim::myProps.begin(); p != Dim::myProps.end(); p++)
-      if (std::find_if(fluxes.begin(),fluxes.end(), hasCode(p->pindx)) != fluxes.end())
-        this->generateThreadGroups(*p,SIMadmin::msgLevel < 2);
+      if (p->lindx > 0 && (p->pcode == Property::NEUMANN ||
+                           p->pcode == Property::NEUMANN_GENERIC ||
+                           p->pcode == Property::ROBIN ||
+                           std::find_if(fluxes.begin(),fluxes.end(),
+                                        hasCode(p->pindx)) != fluxes.end()))
+        if (done.insert(std::make_pair(p->patch,(int)p->lindx)).second)
+          this->generateThreadGroups(*p,SIMadmin::msgLevel < 2);
 
     return true;
   }
 
   //! \brief Initializes material properties for integration of interior terms.
   //! \param[in] propInd Physical property index
+  //! \details The material set here is only used for elements that are not
+  //! covered by the element material table established in preprocessB().
   virtual bool initMaterial(size_t propInd)
   {
     if (propInd >= mVec.size())
@@ -461,12 +1501,59 @@ private:
   Integrand he;                 //!< Integrand
   typename Integrand::WeakDirichlet wdc; //!< Weak dirichlet integrand
   std::vector<std::unique_ptr<typename Integrand::MaterialType>> mVec;  //!< Material data
+  typename Integrand::MaterialVec elmMat; //!< Material of each element
 
   Vectors temperature;      //!< Temperature solution vectors
   std::string inputContext; //!< Input context
 
   std::vector<BoundaryFlux> fluxes;  //!< Heat fluxes to calculate
   std::vector<BoundaryFlux> senergy; //!< Stored energies to calculate
+
+  //! Open output files of the integrated quantities
+  std::map<std::string,std::unique_ptr<std::ofstream>> outFiles;
+  std::string binFile; //!< Name of binary output file for all sets
+  int flushInc; //!< Step interval for flushing the output files (0: dumps only)
+
+  PreconditionerPolicy pcPolicy; //!< Preconditioner reuse policy
+
+  std::vector<Variant> variants; //!< Ensemble variants of the model
+  std::vector<std::unique_ptr<RealFunc>> varFuncs; //!< Variant functions
+  std::string outputTag; //!< Name of the variant being written
+  std::string ptFile;    //!< Name of the result point file of the model
+  bool sharedLHS; //!< If \e true, the system matrix is shared with the model
+
+  bool   usePredictor; //!< If \e true, solve for the predictor correction
+  Vector prediction;   //!< Predicted temperature of current time level
+  double dtCur;        //!< Step size of the last solved time level
+  double dtLast;       //!< Step size between the two previous time levels
+
+  double cacheBudget;  //!< Memory budget of the point cache in megabytes
+  bool cacheReported; //!< If \e true, the point cache usage has been reported
+
+  bool   reuseMatrix; //!< If \e true, re-use the system matrix between steps
+  bool   haveMatrix;  //!< If \e true, a factorized system matrix is present
+  double lhsCoeff;    //!< Mass matrix coefficient of current system matrix
+
+  int    maxIter; //!< Maximum number of nonlinear iterations
+  double rTol;    //!< Relative convergence tolerance for nonlinear iterations
+  double aTol;    //!< Absolute convergence tolerance for nonlinear iterations
+
+  double adaptTol; //!< Error tolerance for adaptive time stepping
+  double dtMin;    //!< Minimum sub-step size
+  double dtMax;    //!< Maximum sub-step size
+  double dtInit;   //!< Initial sub-step size
+  int maxReject;   //!< Maximum number of consecutive rejected sub-steps
+  double dtPrev;   //!< Size of previous accepted sub-step
+  double dtNext;   //!< Proposed size of next sub-step
+  int nSubSteps;   //!< Number of accepted sub-steps
+
+  bool   matrixFree; //!< If \e true, use the matrix-free operator if possible
+  bool   mfActive;   //!< If \e true, the matrix-free operator is used
+  double mfTol;      //!< Relative residual tolerance of the matrix-free solver
+  int    mfMaxIt;    //!< Maximum number of matrix-free solver iterations
+  double mfKappa;    //!< Constant thermal conductivity of the model
+  double mfRhoCp;    //!< Constant heat capacity per volume of the model
+  TensorHeatOperator mfOp; //!< Sum-factorized operator of the model
 };
 
 
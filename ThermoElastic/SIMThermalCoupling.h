@@ -15,6 +15,10 @@
 #define _SIM_THERMAL_COUPLING_H_
 
 #include "SIMCoupled.h"
+#include "IFEM.h"
+#include "MatVec.h"
+#include "TimeStep.h"
+#include <cmath>
 
 
 //! \brief Struct describing a coupling.
@@ -38,6 +42,15 @@ typedef std::vector<CouplingDef> Couplings; //!< Convenience declaration
   \brief Driver class for thermal coupled simulators.
   \details A thermal coupled simulator is a coupling between a thermal solver
   and another solver.
+
+  Without back-coupling fields, the block system of the coupled problem is
+  lower triangular, since the thermal problem does not depend on the other
+  field. The staggered solve of each step is then the exact block forward
+  substitution of the monolithic system. With back-coupling, the solvers
+  can be iterated within each step, see setIterations().
+  The thermo-elastic application has no back-coupling fields, so the
+  coupling iterations are only available to other applications that provide
+  them through the constructor.
 */
 
 template<class TempSolver, class OtherSolver,
@@ -48,14 +61,133 @@ public:
   //! \brief The constructor initializes the references to the two solvers.
   SIMThermalCoupling(TempSolver& s1, OtherSolver& s2,
                      const Couplings& back_coupling = Couplings())
-    : Coupling<TempSolver,OtherSolver>(s1,s2), m_back_coupling(back_coupling) {}
+    : Coupling<TempSolver,OtherSolver>(s1,s2), m_back_coupling(back_coupling)
+  {
+    maxIter = 1;
+    tol = 1.0e-6;
+    aitken = false;
+    omega0 = 0.5;
+    totIter = nSteps = 0;
+  }
+
+  //! \brief The destructor reports the coupling iteration counts.
+  virtual ~SIMThermalCoupling()
+  {
+    if (nSteps > 0)
+      IFEM::cout <<"\nCoupling iterations: "<< totIter <<" in "<< nSteps
+                 <<" steps (average "<< double(totIter)/nSteps <<")"
+                 << std::endl;
+  }
+
+  //! \brief Enables iterations between the solvers within each time step.
+  //! \param[in] maxit Maximum number of coupling iterations
+  //! \param[in] rtol Relative tolerance on the temperature change
+  //! \param[in] useAitken If \e true, use Aitken relaxation
+  //! \param[in] omega Initial relaxation factor
+  void setIterations(int maxit, double rtol, bool useAitken,
+                     double omega = 0.5)
+  {
+    maxIter = maxit;
+    tol = rtol;
+    aitken = useAitken;
+    omega0 = omega;
+  }
+
+  //! \brief Computes the solution for the current time step.
+  //! \param tp Time stepping parameters
+  //! \param[in] firstS1 If \e true, solve the thermal problem first
+  //! \details Without back-coupling fields, the thermal solution does not
+  //! depend on the other solver, and a single staggered pass is done.
+  //! Otherwise the two solvers are iterated until the relative change of the
+  //! temperature is less than the tolerance. With Aitken relaxation, the
+  //! temperature passed to the other solver is T = T_k + omega*(T~ - T_k),
+  //! where T~ is the new thermal solution and omega is updated dynamically.
+  //! Ensemble runs of the thermal solver are not supported.
+  //! The thermal solver must not shift its time history within solveStep(),
+  //! which rules out adaptive time stepping. The step fails if the iterations
+  //! do not converge.
+  virtual bool solveStep(TimeStep& tp, bool firstS1 = true)
+  {
+    if (this->S1.getNoVariants() > 0) {
+      // The other solver only sees the temperature of the model
+      std::cerr <<" *** SIMThermalCoupling::solveStep: Ensemble variants"
+                <<" are not supported in coupled simulations."<< std::endl;
+      return false;
+    }
+
+    if (maxIter <= 1 || m_back_coupling.empty())
+      return this->Coupling<TempSolver,OtherSolver>::solveStep(tp,firstS1);
 
-  //! \brief Empty destructor.
-  virtual ~SIMThermalCoupling() {}
+    if (this->S1.isAdaptive()) {
+      std::cerr <<" *** SIMThermalCoupling::solveStep: Coupling iterations"
+                <<" can not be combined with adaptive time stepping."
+                << std::endl;
+      return false;
+    }
+
+    Vector Tk, res, prevRes;
+    double omega = aitken ? omega0 : 1.0;
+    for (int it = 1; it <= maxIter; it++) {
+      if (!this->S1.solveStep(tp))
+        return false;
+
+      Vector& T = this->S1.getSolution();
+      double dNorm = 0.0;
+      if (it > 1) {
+        res = T;
+        res -= Tk;
+        dNorm = res.norm2();
+
+        if (aitken && !prevRes.empty()) {
+          // Aitken update of the relaxation factor
+          Vector dRes(res);
+          dRes -= prevRes;
+          double denom = dRes.dot(dRes);
+          if (denom > 0.0)
+            omega = -omega*prevRes.dot(dRes)/denom;
+        }
+
+        if (omega != 1.0) {
+          T = Tk;
+          T.add(res,omega);
+        }
+        prevRes.swap(res);
+      }
+      Tk = T;
+
+      if (!this->S2.solveStep(tp))
+        return false;
+
+      if (it > 1) {
+        double tNorm = T.norm2();
+        IFEM::cout <<"  Coupling iteration "<< it <<": |dT| = "<< dNorm
+                   <<"  |T| = "<< tNorm;
+        if (aitken)
+          IFEM::cout <<"  omega = "<< omega;
+        IFEM::cout << std::endl;
+
+        if (dNorm <= tol*tNorm) {
+          totIter += it;
+          ++nSteps;
+          return true;
+        }
+      }
+    }
+
+    totIter += maxIter;
+    ++nSteps;
+    std::cerr <<" *** SIMThermalCoupling::solveStep: Coupling iterations"
+              <<" did not converge in "<< maxIter <<" iterations."<< std::endl;
+    return false;
+  }
 
   //! \brief Initializes and sets up field dependencies.
   virtual void setupDependencies()
   {
+    if (maxIter > 1 && m_back_coupling.empty())
+      IFEM::cout <<"  ** No back-coupling fields,"
+                 <<" using a single staggered pass in each step."<< std::endl;
+
     this->S2.registerDependency(&this->S1, "temperature1", 1,
                                 this->S1.getFEModel(), 1);
     for (auto& it : m_back_coupling)
@@ -85,6 +217,13 @@ public:
 
 private:
   Couplings m_back_coupling; //!< Couplings from other solver to thermal solver
+
+  int    maxIter; //!< Maximum number of coupling iterations in each step
+  double tol;     //!< Relative convergence tolerance of the temperature
+  bool   aitken;  //!< If \e true, use Aitken relaxation of the temperature
+  double omega0;  //!< Initial relaxation factor
+  int    totIter; //!< Total number of coupling iterations
+  int    nSteps;  //!< Number of time steps with coupling iterations
 };
 
 #endif
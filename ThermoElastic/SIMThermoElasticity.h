@@ -22,6 +22,10 @@
 #include "ASMstruct.h"
 #include "DataExporter.h"
 #include "Profiler.h"
+#include "PreconditionerPolicy.h"
+#include "PredictorCorrection.h"
+#include <chrono>
+#include <sstream>
 
 
 /*!
@@ -40,10 +44,28 @@ public:
     Dim::myHeading = "Thermo-Elasticity solver";
     Dim::msgLevel = 1; // prints the solution summary only
     startT = 0.0;
+    reuseMatrix = haveMatrix = false;
+    solveStride = 0;
+    maxTempChange = 0.0;
+    lastSolved = -1;
+    nSolves = 0;
+    normStride = 1;
+    usePredictor = false;
+    solTime = prevTime = 0.0;
+    solveInfo.resize(2);
   }
 
   //! \brief The destructor clears the VTF-file pointer.
-  virtual ~SIMThermoElasticity() { this->setVTF(nullptr); }
+  virtual ~SIMThermoElasticity()
+  {
+    this->setVTF(nullptr);
+    if (pcPolicy.isActive() && pcPolicy.getNoRebuilds() > 0)
+      IFEM::cout <<"\nElasticity preconditioner: "
+                 << pcPolicy.getNoRebuilds() <<" setups ("
+                 << pcPolicy.getRebuildTime() <<"s), "
+                 << pcPolicy.getNoReuses() <<" reuses ("
+                 << pcPolicy.getReuseTime() <<"s)"<< std::endl;
+  }
 
   //! \brief Registers fields for output to a data exporter.
   void registerFields(DataExporter& exporter)
@@ -54,6 +76,17 @@ public:
     exporter.registerField("solid displacement", "solid displacement",
                            DataExporter::SIM, results);
     exporter.setFieldValue("solid displacement", this, &sol);
+
+    // With sub-cycling, the displacement field is not updated in every step.
+    // The step number and time of the last solve are then exported along
+    // with it, such that stale displacements can be identified.
+    if (solveStride > 0 || !solveTimes.empty() || maxTempChange > 0.0)
+    {
+      exporter.registerField("solid solve step",
+                             "step and time of last elasticity solve",
+                             DataExporter::VECTOR, DataExporter::PRIMARY);
+      exporter.setFieldValue("solid solve step", &solveInfo);
+    }
   }
 
   //! \brief Initializes the solution vector.
@@ -64,7 +97,7 @@ public:
   //! \param[in] nBlock Running VTF block counter
   bool saveStep(const TimeStep& tp, int& nBlock)
   {
-    if (tp.time.t+0.001*tp.time.dt < startT)
+    if (tp.time.t+0.001*tp.time.dt < startT || lastSolved != tp.step)
       return true;
 
     PROFILE1("SIMThermoElasticity::saveStep");
@@ -89,17 +122,102 @@ public:
   //! \brief Computes the solution for the current time step.
   bool solveStep(TimeStep& tp)
   {
-    if (tp.time.t+0.001*tp.time.dt < startT)
+    if (tp.time.t+0.001*tp.time.dt < startT || !this->needSolve(tp))
       return true;
 
     PROFILE1("SIMThermoElasticity::solveStep");
 
-    this->setMode(SIM::STATIC);
+    // With a temperature-independent stiffness, only the thermal load vector
+    // changes between the steps. The stiffness matrix is then assembled and
+    // factorized in the first step only, and later steps re-use the factors.
+    if (reuseMatrix && !haveMatrix && this->hasTempDependentMaterial())
+    {
+      IFEM::cout <<"  ** Temperature-dependent material,"
+                 <<" the stiffness matrix is not re-used."<< std::endl;
+      reuseMatrix = false;
+    }
+    bool newLHS = !reuseMatrix || !haveMatrix;
+    ThermoElasticity* thelp = dynamic_cast<ThermoElasticity*>(Dim::myProblem);
+    if (!newLHS && thelp)
+      // Skip the stiffness matrix evaluation unless needed for Dirichlet lift
+      thelp->setDirichletLHS(this->hasInhomogeneousDirichlet());
+
+    this->setMode(newLHS ? SIM::STATIC : SIM::RHS_ONLY);
     this->setQuadratureRule(Dim::opt.nGauss[0]);
-    if (!this->assembleSystem()) return false;
-    if (!this->solveSystem(sol,1)) return false;
+    if (!this->assembleSystem(TimeDomain(),Vectors(),newLHS)) return false;
+
+    // Solve for the correction of the displacements extrapolated from the
+    // previous solves. This needs the assembled stiffness matrix, which is
+    // only available when it has been re-assembled, or with an iterative
+    // equation solver.
+    PredictorCorrection correction;
+    if (usePredictor)
+    {
+      if (nSolves > 0 && (newLHS || Dim::opt.solver == LinAlg::PETSC ||
+                          Dim::opt.solver == LinAlg::ISTL))
+        if (!correction.apply(*this,this->predict(tp.time.t)))
+          return false;
 
-    return this->postSolve(tp);
+      prevSol = sol;
+      prevTime = solTime;
+    }
+
+    if (!this->solveLinear(newLHS)) return false;
+    if (correction.isActive() && !correction.update(*this,sol)) return false;
+    solTime = tp.time.t;
+    haveMatrix = true;
+    lastSolved = tp.step;
+    solveInfo(1) = tp.step;
+    solveInfo(2) = tp.time.t;
+    ++nSolves;
+    if (thelp)
+      thelp->newSolution(); // invalidate the cached element vectors
+
+    return this->needNorms(tp) ? this->postSolve(tp) : true;
+  }
+
+  //! \brief Toggles re-use of the factorized stiffness matrix between steps.
+  //! \details The matrix is not re-used if any material depends on the
+  //! temperature, which is checked before the first assembly.
+  void setReuseMatrix(bool reuse) { reuseMatrix = reuse; }
+
+  //! \brief Toggles the solution for the correction of a predictor.
+  void setPredictor(bool pred) { usePredictor = pred; }
+
+  //! \brief Returns the number of elasticity solves so far.
+  int getNoSolves() const { return nSolves; }
+
+  //! \brief Returns the displacement solution.
+  const Vector& getSolution() const { return sol; }
+
+  //! \brief Defines how often the solution norms are computed.
+  //! \param[in] stride Compute the norms every \a stride step.
+  //! If zero, compute the norms in the final step only, if negative never.
+  void setNormStride(int stride) { normStride = stride; }
+
+  //! \brief Solves the assembled linear system for the displacements.
+  //! \param[in] newLHS If \e true, the stiffness matrix has been re-assembled
+  //! \details With an iterative equation solver, the preconditioner of the
+  //! previous matrix can be reused for a new matrix, as decided by the
+  //! preconditioner reuse policy.
+  bool solveLinear(bool newLHS)
+  {
+    if (!pcPolicy.isActive() || (Dim::opt.solver != LinAlg::PETSC &&
+                                 Dim::opt.solver != LinAlg::ISTL))
+      return this->solveSystem(sol,1,nullptr,"displacement",newLHS);
+
+    bool newPC = pcPolicy.rebuild(newLHS);
+    auto start = std::chrono::steady_clock::now();
+    if (!this->solveSystem(sol,1,nullptr,"displacement",newPC))
+      return false;
+
+    std::chrono::duration<double> time = std::chrono::steady_clock::now()-start;
+    pcPolicy.update(newPC,time.count());
+    if (Dim::msgLevel > 1)
+      IFEM::cout <<"  Preconditioner "<< (newPC ? "set up" : "reused")
+                 <<", solve time "<< time.count() <<"s"<< std::endl;
+
+    return true;
   }
 
   //! \brief Postprocesses the solution of current time step.
@@ -133,6 +251,87 @@ public:
   }
 
 protected:
+  //! \brief Extrapolates the displacements from the previous solves.
+  //! \param[in] t Time of the current solve
+  //! \details The extrapolation in time is linear when two previous solves
+  //! are available, and constant otherwise.
+  Vector predict(double t) const
+  {
+    Vector x0(sol);
+    if (nSolves > 1 && solTime > prevTime)
+    {
+      double w = (t-solTime)/(solTime-prevTime);
+      x0 *= 1.0 + w;
+      x0.add(prevSol,-w);
+    }
+    return x0;
+  }
+
+  //! \brief Checks whether the solution norms are to be computed in a step.
+  //! \param[in] tp Time stepping parameters
+  bool needNorms(const TimeStep& tp) const
+  {
+    if (normStride < 0)
+      return false;
+    else if (normStride == 0)
+      return tp.time.t+0.5*tp.time.dt >= tp.stopTime;
+
+    return tp.step%normStride == 0;
+  }
+
+  //! \brief Checks whether the elasticity problem is to be solved in a step.
+  //! \param[in] tp Time stepping parameters
+  //! \details Without any sub-cycling criteria, the problem is solved in
+  //! every step. Otherwise it is solved in the first step, every
+  //! \a solveStride step, at the specified times, and whenever the maximum
+  //! temperature change since the last solve exceeds \a maxTempChange.
+  //! It is also solved in the final step if the norms are requested there.
+  bool needSolve(const TimeStep& tp)
+  {
+    if (solveStride < 1 && solveTimes.empty() && maxTempChange <= 0.0)
+      return true;
+
+    const utl::vector<double>* temp = this->getDependentField("temperature1");
+
+    bool solve = lastSolved < 0 || (normStride == 0 && this->needNorms(tp));
+    if (!solve && solveStride > 0)
+      solve = tp.step%solveStride == 0;
+
+    for (size_t i = 0; i < solveTimes.size() && !solve; i++)
+      solve = fabs(tp.time.t-solveTimes[i]) < 0.5*tp.time.dt;
+
+    if (!solve && maxTempChange > 0.0 && temp &&
+        temp->size() == lastTemp.size())
+      for (size_t i = 0; i < lastTemp.size() && !solve; i++)
+        solve = fabs((*temp)[i]-lastTemp[i]) > maxTempChange;
+
+    if (solve && temp && maxTempChange > 0.0)
+      lastTemp = *temp;
+
+    return solve;
+  }
+
+  //! \brief Returns \e true if any material depends on the temperature.
+  bool hasTempDependentMaterial() const
+  {
+    for (const Material* mat : this->mVec)
+      if (ThermoElasticity::isTempDependent(mat))
+        return true;
+
+    return false;
+  }
+
+  //! \brief Returns \e true if the model has inhomogeneous Dirichlet conditions.
+  bool hasInhomogeneousDirichlet() const
+  {
+    for (const Property& p : Dim::myProps)
+      if (p.pcode == Property::DIRICHLET_INHOM ||
+          p.pcode == Property::DIRICHLET_ANASOL)
+        return true;
+
+    return false;
+  }
+
   using SIMElasticity<Dim>::parse;
   //! \brief Parses a data section from an XML element.
   //! \param[in] elem The XML element to parse
@@ -146,6 +345,64 @@ protected:
       if (!strcasecmp(child->Value(),"start"))
         utl::getAttribute(child,"time",startT);
 
+      else if (!strcasecmp(child->Value(),"subcycling"))
+      {
+        utl::getAttribute(child,"stride",solveStride);
+        utl::getAttribute(child,"maxdT",maxTempChange);
+        if (child->FirstChild())
+        {
+          std::istringstream times(child->FirstChild()->Value());
+          double t;
+          while (times >> t)
+            solveTimes.push_back(t);
+        }
+        IFEM::cout <<"\tSub-cycling: stride="<< solveStride
+                   <<" maxdT="<< maxTempChange;
+        if (!solveTimes.empty())
+          IFEM::cout <<" at "<< solveTimes.size() <<" given times";
+        IFEM::cout << std::endl;
+      }
+
+      else if (!strcasecmp(child->Value(),"postprocessing"))
+      {
+        std::string mode;
+        utl::getAttribute(child,"stride",normStride);
+        if (utl::getAttribute(child,"mode",mode,true))
+        {
+          if (mode == "final")
+            normStride = 0;
+          else if (mode == "off")
+            normStride = -1;
+        }
+        IFEM::cout <<"\tSolution norms: ";
+        if (normStride > 0)
+          IFEM::cout <<"every "<< normStride <<" step";
+        else
+          IFEM::cout << (normStride == 0 ? "final step only" : "off");
+        IFEM::cout << std::endl;
+      }
+
+      else if (!strcasecmp(child->Value(),"preconditioner"))
+      {
+        pcPolicy.parse(child);
+        IFEM::cout <<"\tPreconditioner reuse policy: "
+                   << pcPolicy.getName() << std::endl;
+      }
+
+      else if (!strcasecmp(child->Value(),"predictor"))
+      {
+        usePredictor = true;
+        IFEM::cout <<"\tSolving for the correction of extrapolated"
+                   <<" displacements"<< std::endl;
+      }
+
+      else if (!strcasecmp(child->Value(),"reusematrix"))
+      {
+        reuseMatrix = true;
+        IFEM::cout <<"\tRe-using factorized stiffness matrix between steps"
+                   << std::endl;
+      }
+
       else if (!strcasecmp(child->Value(),"anasol"))
       {
         std::string type;
@@ -189,8 +446,26 @@ protected:
   }
 
 private:
-  Vector sol;    //!< Primary solution vector
-  double startT; //!< Start time for the elasticity solver
+  Vector sol;       //!< Primary solution vector
+  double startT;    //!< Start time for the elasticity solver
+  bool reuseMatrix; //!< If \e true, factorize the stiffness matrix only once
+  bool haveMatrix;  //!< If \e true, a factorized stiffness matrix is present
+
+  int    solveStride;   //!< Solve every \a solveStride thermal step
+  double maxTempChange; //!< Solve when the temperature changes this much
+  Vector solveTimes;    //!< Solve at these times
+  Vector lastTemp;      //!< Temperature field at last elasticity solve
+  int    lastSolved;    //!< Time step of last elasticity solve
+  Vector solveInfo;     //!< Step and time of last elasticity solve
+  int    nSolves;       //!< Number of elasticity solves
+
+  bool   usePredictor; //!< If \e true, solve for the predictor correction
+  Vector prevSol;      //!< Displacements of the second last solve
+  double solTime;      //!< Time of the last solve
+  double prevTime;     //!< Time of the second last solve
+  int    normStride;    //!< Step interval for the solution norms (0: final)
+
+  PreconditionerPolicy pcPolicy; //!< Preconditioner reuse policy
 };
 
 
@@ -0,0 +1,91 @@
+// $Id$
+//==============================================================================
+//!
+//! \file StepSizeControl.h
+//!
+//! \date Oct 15 2026
+//!
+//! \author agent
+//!
+//! \brief Step size controller for adaptive time stepping.
+//!
+//==============================================================================
+
+#ifndef _STEP_SIZE_CONTROL_H
+#define _STEP_SIZE_CONTROL_H
+
+#include <algorithm>
+#include <cmath>
+
+
+/*!
+  \brief Class deciding on the acceptance and size of adaptive time steps.
+  \details A step is accepted if its estimated local error is within the
+  tolerance. The size of the next step, or of the retry of a rejected step,
+  is scaled by 0.9*sqrt(tol/err), limited to the range [0.2,2].
+  The controller gives up if the error estimate is not finite, if a step of
+  the minimum size is rejected, or if too many consecutive steps are rejected.
+*/
+
+class StepSizeControl
+{
+public:
+  //! \brief Enum defining the outcome of a step.
+  enum Decision { ACCEPT, REJECT, FAIL };
+
+  //! \brief The constructor initializes the controller parameters.
+  //! \param[in] tol Error tolerance
+  //! \param[in] dtMin Minimum step size
+  //! \param[in] dtMax Maximum step size (no limit if zero)
+  //! \param[in] maxRej Maximum number of consecutive rejected steps
+  StepSizeControl(double tol, double dtMin, double dtMax = 0.0,
+                  int maxRej = 10) : adaptTol(tol), minStep(dtMin),
+    maxStep(dtMax), maxReject(maxRej), nReject(0), dtNext(0.0) {}
+
+  //! \brief Checks the error estimate of a step.
+  //! \param[in] err Estimated relative local error (negative if unknown)
+  //! \param[in] dt Size of the step
+  //! \return The decision on the step. The size of the next step is then
+  //! available through getStepSize().
+  Decision check(double err, double dt)
+  {
+    dtNext = dt;
+    if (!std::isfinite(err))
+      return FAIL;
+
+    double factor = 1.0;
+    if (err > 0.0)
+      factor = std::max(0.2,std::min(2.0,0.9*sqrt(adaptTol/err)));
+    else if (err == 0.0)
+      factor = 2.0;
+
+    dtNext = std::max(minStep,dt*factor);
+    if (maxStep > 0.0)
+      dtNext = std::min(maxStep,dtNext);
+
+    if (err <= adaptTol) {
+      nReject = 0;
+      return ACCEPT;
+    }
+
+    if (dt <= minStep*(1.0+1.0e-12) || ++nReject > maxReject)
+      return FAIL;
+
+    return REJECT;
+  }
+
+  //! \brief Returns the proposed size of the next step.
+  double getStepSize() const { return dtNext; }
+  //! \brief Returns the number of consecutive rejected steps.
+  int getNoRejections() const { return nReject; }
+
+private:
+  double adaptTol;  //!< Error tolerance
+  double minStep;   //!< Minimum step size
+  double maxStep;   //!< Maximum step size
+  int    maxReject; //!< Maximum number of consecutive rejected steps
+  int    nReject;   //!< Number of consecutive rejected steps
+  double dtNext;    //!< Proposed size of next step
+};
+
+#endif
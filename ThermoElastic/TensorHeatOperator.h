@@ -0,0 +1,370 @@
+// $Id$
+//==============================================================================
+//!
+//! \file TensorHeatOperator.h
+//!
+//! \date Oct 16 2026
+//!
+//! \author agent
+//!
+//! \brief Matrix-free heat equation operator of a tensor-product spline patch.
+//!
+//==============================================================================
+
+#ifndef _TENSOR_HEAT_OPERATOR_H
+#define _TENSOR_HEAT_OPERATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+
+/*!
+  \brief Class applying the heat equation operator of a spline patch.
+  \details The operator A = m*M + k*K, with M the mass matrix and K the
+  Laplacian, is applied to a vector by sum factorization, without assembling
+  it. This requires constant coefficients m and k, and an axis-aligned
+  box-shaped patch with a non-rational tensor-product spline basis.
+  The matrices are then Kronecker products of the univariate matrices,
+  e.g., M = My (x) Mx and K = My (x) Kx + Ky (x) Mx in 2D, which are applied
+  one parameter direction at a time. Only the banded univariate matrices are
+  stored.
+
+  The basis functions are numbered with the first parameter direction
+  running fastest, like the nodes of the ASMs2D and ASMs3D patches.
+*/
+
+class TensorHeatOperator
+{
+public:
+  //! \brief Default constructor.
+  TensorHeatOperator() : nTot(0), kappa(1.0), mass(0.0) {}
+
+  //! \brief Sets up the univariate matrices of a box-shaped patch.
+  //! \param[in] knots Knot vector of each parameter direction
+  //! \param[in] order Order (polynomial degree + 1) of each parameter direction
+  //! \param[in] length Size of the box in each parameter direction
+  bool init(const std::vector< std::vector<double> >& knots,
+            const std::vector<int>& order, const std::vector<double>& length)
+  {
+    dirs.clear();
+    nTot = 0;
+    if (knots.empty() || knots.size() != order.size() ||
+        knots.size() != length.size())
+      return false;
+
+    nTot = 1;
+    dirs.resize(knots.size());
+    for (size_t d = 0; d < knots.size(); d++)
+      if (!dirs[d].init(knots[d],order[d],length[d]))
+      {
+        dirs.clear();
+        nTot = 0;
+        return false;
+      }
+      else
+        nTot *= dirs[d].n;
+
+    return true;
+  }
+
+  //! \brief Sets the coefficients of the operator.
+  //! \param[in] k Coefficient of the Laplacian (thermal conductivity)
+  //! \param[in] m Coefficient of the mass matrix
+  void setCoefficients(double k, double m) { kappa = k; mass = m; }
+
+  //! \brief Returns the number of basis functions of the patch.
+  size_t size() const { return nTot; }
+
+  //! \brief Applies the operator, y = A*x.
+  void apply(const std::vector<double>& x, std::vector<double>& y) const
+  {
+    y.assign(nTot,0.0);
+    std::vector<double> tmp, work;
+    for (size_t t = 0; t <= dirs.size(); t++)
+    {
+      // Term t < dim is the Laplacian in direction t, the last one the mass
+      double c = t < dirs.size() ? kappa : mass;
+      if (c == 0.0) continue;
+
+      tmp = x;
+      for (size_t d = 0; d < dirs.size(); d++)
+      {
+        this->applyDir(d, t == d ? dirs[d].K : dirs[d].M, tmp, work);
+        tmp.swap(work);
+      }
+      for (size_t i = 0; i < nTot; i++)
+        y[i] += c*tmp[i];
+    }
+  }
+
+  //! \brief Computes the diagonal of the operator.
+  void diagonal(std::vector<double>& diag) const
+  {
+    diag.assign(nTot,0.0);
+    for (size_t i = 0; i < nTot; i++)
+    {
+      // Diagonal of the univariate matrices at the tensor index of i
+      double dM = 1.0, dK = 0.0;
+      size_t j = i;
+      for (const Direction& dir : dirs)
+      {
+        size_t k = (j % dir.n)*dir.bw + dir.p;
+        dK = dK*dir.M[k] + dM*dir.K[k];
+        dM *= dir.M[k];
+        j /= dir.n;
+      }
+      diag[i] = mass*dM + kappa*dK;
+    }
+  }
+
+  //! \brief Solves A*x = b by Jacobi-preconditioned conjugate gradients.
+  //! \param[in] fixed Flags for the basis functions with zero value
+  //! \param[in] b Right-hand-side vector, ignored at the fixed functions
+  //! \param x Initial guess on input, the solution on output
+  //! \param[in] tol Relative residual tolerance
+  //! \param[in] maxIt Maximum number of iterations
+  //! \return Number of iterations, or negative if not converged
+  int solve(const std::vector<bool>& fixed, const std::vector<double>& b,
+            std::vector<double>& x, double tol, int maxIt) const
+  {
+    if (fixed.size() != nTot || b.size() != nTot)
+      return -1;
+
+    x.resize(nTot,0.0);
+    for (size_t i = 0; i < nTot; i++)
+      if (fixed[i])
+        x[i] = 0.0;
+
+    std::vector<double> diag, r, z, p, q;
+    this->diagonal(diag);
+    this->apply(x,q);
+
+    double bNorm = 0.0, rz = 0.0;
+    r.resize(nTot,0.0);
+    z.resize(nTot,0.0);
+    for (size_t i = 0; i < nTot; i++)
+      if (!fixed[i])
+      {
+        bNorm += b[i]*b[i];
+        r[i] = b[i] - q[i];
+        z[i] = diag[i] != 0.0 ? r[i]/diag[i] : r[i];
+        rz += r[i]*z[i];
+      }
+
+    bNorm = sqrt(bNorm);
+    if (this->norm(r) <= tol*bNorm)
+      return 0;
+
+    p = z;
+    for (int it = 1; it <= maxIt; it++)
+    {
+      this->apply(p,q);
+      double pq = 0.0;
+      for (size_t i = 0; i < nTot; i++)
+        if (!fixed[i])
+          pq += p[i]*q[i];
+      if (pq <= 0.0)
+        return -it; // the operator is not positive definite
+
+      double alpha = rz/pq;
+      for (size_t i = 0; i < nTot; i++)
+        if (!fixed[i])
+        {
+          x[i] += alpha*p[i];
+          r[i] -= alpha*q[i];
+        }
+
+      if (this->norm(r) <= tol*bNorm)
+        return it;
+
+      double rzOld = rz;
+      rz = 0.0;
+      for (size_t i = 0; i < nTot; i++)
+        if (!fixed[i])
+        {
+          z[i] = diag[i] != 0.0 ? r[i]/diag[i] : r[i];
+          rz += r[i]*z[i];
+        }
+
+      for (size_t i = 0; i < nTot; i++)
+        p[i] = fixed[i] ? 0.0 : z[i] + rz/rzOld*p[i];
+    }
+
+    return -maxIt;
+  }
+
+private:
+  //! \brief Banded univariate matrices of one parameter direction.
+  struct Direction
+  {
+    size_t n;  //!< Number of basis functions
+    int    p;  //!< Polynomial degree, the half bandwidth
+    int    bw; //!< Bandwidth, 2p+1
+    std::vector<double> M; //!< Mass matrix, stored by rows of the band
+    std::vector<double> K; //!< Laplacian, stored by rows of the band
+
+    //! \brief Integrates the univariate matrices.
+    //! \param[in] U Knot vector
+    //! \param[in] order Order of the basis
+    //! \param[in] length Size of the physical domain
+    bool init(const std::vector<double>& U, int order, double length)
+    {
+      if (order < 1 || U.size() <= (size_t)order || length <= 0.0)
+        return false;
+
+      p = order-1;
+      bw = 2*p+1;
+      n = U.size() - order;
+      M.assign(n*bw,0.0);
+      K.assign(n*bw,0.0);
+
+      double span = U[n] - U[p];
+      if (span <= 0.0)
+        return false;
+      double J = length/span; // dx/du
+
+      std::vector<double> xg, wg, N(order), dN(order);
+      gauss(order,xg,wg);
+      for (size_t mu = p; mu < n; mu++)
+      {
+        double du = U[mu+1] - U[mu];
+        if (du <= 0.0) continue;
+
+        for (size_t g = 0; g < xg.size(); g++)
+        {
+          double u = U[mu] + 0.5*du*(1.0+xg[g]);
+          double w = 0.5*du*wg[g];
+          basis(U,p,mu,u,N,dN);
+          for (int a = 0; a <= p; a++)
+            for (int b = 0; b <= p; b++)
+            {
+              size_t k = (mu-p+a)*bw + p + b-a;
+              M[k] += N[a]*N[b]*w*J;
+              K[k] += dN[a]*dN[b]*w/J;
+            }
+        }
+      }
+
+      return true;
+    }
+  };
+
+  //! \brief Applies a banded univariate matrix in one parameter direction.
+  //! \param[in] d The parameter direction
+  //! \param[in] A The banded matrix
+  //! \param[in] in The vector to multiply
+  //! \param[out] out The product
+  void applyDir(size_t d, const std::vector<double>& A,
+                const std::vector<double>& in, std::vector<double>& out) const
+  {
+    const Direction& dir = dirs[d];
+    size_t stride = 1;
+    for (size_t e = 0; e < d; e++)
+      stride *= dirs[e].n;
+    size_t nOuter = nTot/(stride*dir.n);
+
+    out.assign(nTot,0.0);
+    for (size_t o = 0; o < nOuter; o++)
+      for (size_t i = 0; i < dir.n; i++)
+      {
+        size_t jmin = i > (size_t)dir.p ? i-dir.p : 0;
+        size_t jmax = std::min(i+dir.p,dir.n-1);
+        const double* row = &A[i*dir.bw + dir.p - i];
+        double* y = &out[(o*dir.n + i)*stride];
+        for (size_t j = jmin; j <= jmax; j++)
+        {
+          const double* x = &in[(o*dir.n + j)*stride];
+          for (size_t s = 0; s < stride; s++)
+            y[s] += row[j]*x[s];
+        }
+      }
+  }
+
+  //! \brief Returns the Euclidean norm of a vector.
+  static double norm(const std::vector<double>& x)
+  {
+    double sum = 0.0;
+    for (double v : x)
+      sum += v*v;
+    return sqrt(sum);
+  }
+
+  //! \brief Evaluates the non-zero B-spline basis functions at a point.
+  //! \param[in] U Knot vector
+  //! \param[in] p Polynomial degree
+  //! \param[in] mu Index of the knot span, U[mu] <= u < U[mu+1]
+  //! \param[in] u Parameter value
+  //! \param[out] N Values of the basis functions mu-p,...,mu
+  //! \param[out] dN First derivatives of the basis functions
+  static void basis(const std::vector<double>& U, int p, size_t mu, double u,
+                    std::vector<double>& N, std::vector<double>& dN)
+  {
+    // The Cox-de Boor recursion, keeping the values of degree p-1
+    std::vector<double> left(p+1), right(p+1), lower;
+    N.assign(p+1,0.0);
+    dN.assign(p+1,0.0);
+    N[0] = 1.0;
+    for (int j = 1; j <= p; j++)
+    {
+      if (j == p)
+        lower.assign(N.begin(),N.begin()+p);
+      left[j] = u - U[mu+1-j];
+      right[j] = U[mu+j] - u;
+      double saved = 0.0;
+      for (int r = 0; r < j; r++)
+      {
+        double temp = N[r]/(right[r+1] + left[j-r]);
+        N[r] = saved + right[r+1]*temp;
+        saved = left[j-r]*temp;
+      }
+      N[j] = saved;
+    }
+
+    // Derivatives from the basis functions of degree p-1
+    for (int r = 0; r <= p && p > 0; r++)
+    {
+      size_t i = mu-p+r;
+      if (r > 0 && U[i+p] > U[i])
+        dN[r] += p*lower[r-1]/(U[i+p] - U[i]);
+      if (r < p && U[i+p+1] > U[i+1])
+        dN[r] -= p*lower[r]/(U[i+p+1] - U[i+1]);
+    }
+  }
+
+  //! \brief Computes the Gauss-Legendre points and weights on [-1,1].
+  static void gauss(int n, std::vector<double>& xg, std::vector<double>& wg)
+  {
+    xg.resize(n);
+    wg.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+      // Newton iterations on the Legendre polynomial of degree n
+      double x = cos(M_PI*(i+0.75)/(n+0.5)), dP = 1.0;
+      for (int it = 0; it < 100; it++)
+      {
+        double P0 = 1.0, P1 = x;
+        for (int k = 2; k <= n; k++)
+        {
+          double P2 = ((2*k-1)*x*P1 - (k-1)*P0)/k;
+          P0 = P1;
+          P1 = P2;
+        }
+        dP = n*(x*P1 - P0)/(x*x - 1.0);
+        double dx = P1/dP;
+        x -= dx;
+        if (fabs(dx) < 1.0e-15) break;
+      }
+      xg[i] = x;
+      wg[i] = 2.0/((1.0 - x*x)*dP*dP);
+    }
+  }
+
+  std::vector<Direction> dirs; //!< Univariate matrices of each direction
+  size_t nTot;  //!< Total number of basis functions
+  double kappa; //!< Coefficient of the Laplacian
+  double mass;  //!< Coefficient of the mass matrix
+};
+
+#endif
@@ -34,6 +34,27 @@ public:
   //! \brief Empty destructor.
   virtual ~ThermoElasticity() {}
 
+  //! \brief Defines the solution mode before the element assembly is started.
+  //! \param[in] mode The solution mode to use
+  //! \details In SIM::RHS_ONLY mode the stiffness matrix is not evaluated,
+  //! unless it is needed for inhomogeneous Dirichlet conditions.
+  virtual void setMode(SIM::SolutionMode mode);
+
+  //! \brief Toggles evaluation of the stiffness matrix in RHS_ONLY mode.
+  void setDirichletLHS(bool lhs) { dirichletLHS = lhs; }
+
+  //! \brief Checks whether the material properties depend on temperature.
+  //! \param[in] mat The material to check
+  //! \details The Material interface has no such query, so the thermal
+  //! expansion coefficient is sampled over a range of temperatures. The
+  //! stiffness of the linear elastic materials does not take a temperature.
+  static bool isTempDependent(const Material* mat);
+
+  //! \brief Invalidates the cached element vectors used by evalSol().
+  //! \details This must be invoked whenever the displacement or temperature
+  //! solution has changed. The caching is disabled until the first call.
+  void newSolution() { ++solVersion; }
+
   //! \brief Initializes current element for numerical integration.
   //! \param[in] MNPC Matrix of nodal point correspondance for current element
   //! \param elmInt Local integral for element
@@ -68,7 +89,21 @@ protected:
                                     const Vec3& X, double detJW) const;
 
 private:
-  Vector myTempVec; //!< Current temperature at nodal points
+  //! \brief Struct with the gathered solution vectors of an element.
+  struct ElmCache
+  {
+    int    iel;     //!< Global element number of the cached vectors
+    size_t version; //!< Solution version of the cached vectors
+    Vectors eV;     //!< Element displacement and temperature vectors
+    //! \brief Default constructor.
+    ElmCache() : iel(0), version(0), eV(2) {}
+  };
+
+  Vector myTempVec;  //!< Current temperature at nodal points
+  bool dirichletLHS; //!< If \e true, evaluate stiffness in RHS_ONLY mode
+
+  size_t solVersion; //!< Version of current solution, 0 disables the caching
+  mutable std::vector<ElmCache> evalCache; //!< Element vectors of each thread
 };
 
 #endif